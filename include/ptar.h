@@ -34,18 +34,59 @@ extern "C"
 {
 #endif
 
-#ifdef ERR_STREAM
-#undef ERR_STREAM
-#endif
-#define LOG_FILE_PATH "error.log"
-#define ERR_STREAM fopen(LOG_FILE_PATH, "a+")
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#ifdef POSIX_SYSTEM
+#include <sys/types.h>
+#include <sys/uio.h>
+#endif
 #include <ptrace.h>
 #define PTAR_VERSION "0.1.0"
 
+/* Size of the user-space batch buffer used by the streaming writer */
+#ifndef PTAR_STREAM_BUFSIZE
+#define PTAR_STREAM_BUFSIZE (1024 * 1024)
+#endif
+
+/* Flags for ptar_open_fd, or'ed with PROT_READ or PROT_WRITE */
+#define PTAR_FD_PREAD   0x1000  /* use pread/pwrite even if the fd can be mapped */
+#define PTAR_FD_OWN     0x2000  /* ptar_close closes the fd */
+
+/* Mode flag for ptar_open: with PROT_WRITE, resume after the existing
+ * end-of-archive marker instead of writing over the archive */
+#define PTAR_APPEND     0x4000
+
+/* Default uncompressed size of the frames of a framed member */
+#ifndef PTAR_FRAME_SIZE
+#define PTAR_FRAME_SIZE (64 * 1024)
+#endif
+
+/* Size of the first arena of an in-memory archive. Later arenas double */
+#ifndef PTAR_MEMBUF_CHUNK
+#define PTAR_MEMBUF_CHUNK (64 * 1024)
+#endif
+
+/* Buffers of the compression stage, and the levels it compresses at */
+#ifndef PTAR_CODEC_BUFSIZE
+#define PTAR_CODEC_BUFSIZE (256 * 1024)
+#endif
+/* Uncompressed size of the blocks the parallel writer compresses */
+#ifndef PTAR_CODEC_BLOCK
+#define PTAR_CODEC_BLOCK (1024 * 1024)
+#endif
+#ifndef PTAR_GZIP_LEVEL
+#define PTAR_GZIP_LEVEL 6
+#endif
+#ifndef PTAR_ZSTD_LEVEL
+#define PTAR_ZSTD_LEVEL 3
+#endif
+
+/* Default capacity of a trained dictionary. zlib uses at most 32 KiB */
+#ifndef PTAR_DICT_SIZE
+#define PTAR_DICT_SIZE (64 * 1024)
+#endif
+
 #ifndef offsetof
 #define offsetof(TYPE, ELEMENT) ((size_t)&(((TYPE *)0)->ELEMENT))
 #endif
@@ -59,7 +100,19 @@ extern "C"
     PTAR_ESEEKFAIL = -5,
     PTAR_EBADCHKSUM = -6,
     PTAR_ENULLRECORD = -7,
-    PTAR_ENOTFOUND = -8
+    PTAR_ENOTFOUND = -8,
+    PTAR_ENOTSUP = -9,
+    PTAR_ECORRUPT = -10,
+    PTAR_ENOTDIR = -11
+  };
+
+  /* Codecs of compressed members */
+  enum
+  {
+    PTAR_CODEC_NONE = 0,
+    PTAR_CODEC_ZLIB = 1,
+    PTAR_CODEC_GZIP = 2,
+    PTAR_CODEC_ZSTD = 3
   };
 
   enum
@@ -70,7 +123,16 @@ extern "C"
     PTAR_TCHR = '3',
     PTAR_TBLK = '4',
     PTAR_TDIR = '5',
-    PTAR_TFIFO = '6'
+    PTAR_TFIFO = '6',
+    /* Deleted member. Readers hop over it, ptar_compact reclaims it. Stock
+     * tar does not know the type and extracts it as a zero-filled file */
+    PTAR_TDEAD = 'Z',
+    /* Member compressed as independent frames, see ptar_write_file_framed */
+    PTAR_TFRAMED = 'F',
+    /* Compression dictionary shared by framed members, see ptar_write_dict */
+    PTAR_TDICT = 'Q',
+    /* GNU sparse file: only the data segments are stored, see ptar_add_file */
+    PTAR_TSPARSE = 'S'
   };
 
   typedef struct
@@ -85,6 +147,11 @@ extern "C"
   } ptar_header_t;
 
   typedef struct ptar_t ptar_t;
+  struct ptar_dict;
+  struct ptar_dedup;
+  struct ptar_index;
+  struct ptar_frames;
+  struct ptar_dicts;
 
   struct ptar_t
   {
@@ -100,15 +167,85 @@ extern "C"
     unsigned pos;
     unsigned remaining_data;
     unsigned last_header;
+    /* Dictionary new framed members are compressed with, and the last one
+     * loaded for reading */
+    struct ptar_dict *dict;
+    struct ptar_dict *dict_cache;
+    /* Offsets of the dictionaries in the archive, see ptar_dict_find */
+    struct ptar_dicts *dicts;
+    /* Payloads already written, when deduplication is on */
+    struct ptar_dedup *dedup;
+    /* Member index, see ptar_index_build */
+    struct ptar_index *index;
+    /* Last frame decoded from a framed member */
+    struct ptar_frames *frames;
+    /* Set by backends that can not read back what they write (streams,
+     * compressors) */
+    int no_readback;
   };
 
+  typedef struct
+  {
+    unsigned members;
+    unsigned bloom_bits;
+    unsigned bloom_hashes;
+    unsigned lookups;
+    /* Misses answered by the Bloom filter without reading the archive */
+    unsigned bloom_negatives;
+    /* Names the filter let through that were not in the archive */
+    unsigned false_positives;
+    /* Expected false positive rate at the current fill of the filter */
+    double fp_rate;
+  } ptar_index_stats_t;
+
+  /* Member reported by ptar_list_prefix and ptar_list_glob */
+  typedef struct
+  {
+    /* Owned by the index: valid until it is dropped */
+    const char *name;
+    /* Header offset, for ptar_seek */
+    unsigned offset;
+    /* Logical size, as ptar_read_header reports it */
+    unsigned size;
+    unsigned type;
+  } ptar_entry_t;
+
+  /* Listing callback; a nonzero return stops the listing */
+  typedef int
+  (*ptar_list_fn) (void *ctx, const ptar_entry_t *e);
+
+  /* Allocator used for the arenas of an in-memory archive */
+  typedef struct
+  {
+    void *
+    (*alloc) (void *ctx, size_t size);
+    void
+    (*free) (void *ctx, void *ptr);
+    void *ctx;
+  } ptar_allocator_t;
+
   struct mmap_info
   {
     int fd;
     unsigned char *data;
     unsigned size;
+    /* Page aligned start and length of the mapping, NULL if not mapped */
+    unsigned char *base;
+    size_t map_size;
+    /* File offset of data */
+    off_t offset;
+    int own_fd;
+    int prot;
+    /* Whole file opened for writing: extended on demand, trimmed on close */
+    int grow;
+    /* File size at open and end of the data written since */
+    unsigned file_size;
+    unsigned end;
   };
 
+  const char*
+  ptar_strerror (int err);
+
   int
   ptar_close (ptar_t *tar);
 
@@ -124,6 +261,10 @@ extern "C"
   ptar_read_header (ptar_t *tar, ptar_header_t *h);
   int
   ptar_read_data (ptar_t *tar, void *ptr, unsigned size);
+  /* Read [offset, offset + size) of the member whose header is at the
+   * current position. Of a framed member only the frames needed are decoded */
+  int
+  ptar_read_range (ptar_t *tar, unsigned offset, void *ptr, unsigned size);
 
   int
   ptar_write_header (ptar_t *tar, const ptar_header_t *h);
@@ -133,8 +274,88 @@ extern "C"
   ptar_write_dir_header (ptar_t *tar, const char *name);
   int
   ptar_write_data (ptar_t *tar, const void *data, unsigned size);
+  /* Index the member names with one scan of the headers. ptar_find then
+   * reads a single header per hit, and a Bloom filter answers most misses
+   * without reading anything; ptar_seek_end jumps straight to the end.
+   * Members written later are indexed as they are written. ptar_compact
+   * drops the index, ptar_index_drop frees it. */
+  int
+  ptar_index_build (ptar_t *tar);
+  void
+  ptar_index_drop (ptar_t *tar);
+  int
+  ptar_index_stats (ptar_t *tar, ptar_index_stats_t *stats);
+  /* List the members whose name starts with prefix, in name order. The
+   * index (built here if need be) keeps the names sorted, so this takes a
+   * binary search plus one step per member listed; only framed and sparse
+   * members have their header read, for their logical size. */
+  int
+  ptar_list_prefix (ptar_t *tar, const char *prefix, ptar_list_fn fn,
+                    void *ctx);
+  /* List the members matching a glob pattern ('*', '?', "[a-z]", "[!a-z]",
+   * '\' quoting), in name order. '*' also matches '/'. Only the names
+   * starting with the literal head of the pattern are tried. */
+  int
+  ptar_list_glob (ptar_t *tar, const char *pattern, ptar_list_fn fn,
+                  void *ctx);
+  /* Write a whole regular member. With deduplication on (ptar_set_dedup), a
+   * payload equal to an earlier one is written as a PTAR_TLNK header naming
+   * it instead. Candidates are found by a 64-bit hash and confirmed by
+   * reading the earlier copy back, so backends that can not read while
+   * writing (streams, compressors) always get full copies. */
+  int
+  ptar_write_file (ptar_t *tar, const char *name, const void *data,
+                   unsigned size);
+  int
+  ptar_set_dedup (ptar_t *tar, int enable);
+  /* Train a dictionary of at most `capacity` bytes (0: PTAR_DICT_SIZE) on
+   * `count` sample buffers and store it as a PTAR_TDICT entry. Framed members
+   * written afterwards with the same codec are compressed with it, which
+   * pays off for many small similar members; readers find it by id. zstd
+   * trains a real dictionary, zlib presets the most recent sample bytes. */
+  int
+  ptar_write_dict (ptar_t *tar, int codec, const void *const *samples,
+                   const unsigned *sizes, unsigned count, unsigned capacity);
+  /* Write a whole member compressed with codec, as independent frames of
+   * frame_size bytes (0: PTAR_FRAME_SIZE) followed by a frame index. It reads
+   * back through ptar_read_data / ptar_read_range like a regular file. */
+  int
+  ptar_write_file_framed (ptar_t *tar, const char *name, const void *data,
+                          unsigned size, int codec, unsigned frame_size);
   int
   ptar_finalize (ptar_t *tar);
+  /* Position the writer on the end-of-archive marker, so that new members
+   * replace it. Only headers are read while looking for it. */
+  int
+  ptar_seek_end (ptar_t *tar);
+  /* Mark member `name` dead and punch a hole over its payload. The header is
+   * kept so offsets of the other members do not change. Run ptar_compact
+   * before handing the archive to other tar readers: they see the member
+   * again, zero-filled */
+  int
+  ptar_delete (ptar_t *tar, const char *name);
+  /* Slide live members down over dead ones, moving at most `budget` bytes
+   * per call (0: no limit). Returns 1 while more work is left, the archive
+   * stays readable between calls. */
+  int
+  ptar_compact (ptar_t *tar, unsigned budget);
+
+  /* In-memory writer. NULL allocator means malloc/free */
+  int
+  ptar_open_membuf (ptar_t *tar, const ptar_allocator_t *allocator);
+  /* Finished archive as one buffer, owned by tar until ptar_close.
+   * Arenas are coalesced with a single copy only if more than one is used. */
+  int
+  ptar_membuf_data (ptar_t *tar, const void **data, unsigned *size);
+
+  /* Whole-archive compression (.tar.gz with PTAR_CODEC_GZIP, .tar.zst with
+   * PTAR_CODEC_ZSTD) over an opened backend. mode is PROT_READ or PROT_WRITE.
+   * Writes are compressed on the fly, so only sequential writing works.
+   * Reads decode front to back; seeking back decodes again from the start.
+   * lower must outlive tar and is not closed with it: ptar_close(tar) ends
+   * the compressed stream, then lower can be closed. */
+  int
+  ptar_open_compressed (ptar_t *tar, ptar_t *lower, int codec, int mode);
 
 #ifdef POSIX_SYSTEM
   int
@@ -145,6 +366,43 @@ extern "C"
   ptar_get_pointer (ptar_t *tar, const void **ptr);
   int
   ptar_open (ptar_t *tar, const char *filename, const int mode);
+  /* Archive on a pipe, socket or any other fd. No seek, no mmap. It is
+   * either written, or read front to back (seeking back only works into data
+   * still buffered). The fd is not closed by ptar_close, which flushes writes. */
+  int
+  ptar_open_stream (ptar_t *tar, int fd);
+  /* Archive stored in [offset, offset + length) of fd. length 0 means up to
+   * the end of the file. The window is mapped, falling back to pread. A
+   * window read past the end of a file is refused; one written past it
+   * goes through pwrite. Without PROT_READ or PROT_WRITE it is read. */
+  int
+  ptar_open_fd (ptar_t *tar, int fd, off_t offset, unsigned length, int flags);
+  /* Open member `name` of outer, itself an archive, as inner. inner is a
+   * window of the outer mapping (or fd) and is only valid while outer is open.
+   * Members of inner can be opened the same way. */
+  int
+  ptar_open_member (ptar_t *outer, const char *name, ptar_t *inner);
+  /* Read an archive held in caller owned memory. Nothing is copied */
+  int
+  ptar_open_memory (ptar_t *tar, const void *buf, unsigned len);
+  /* Arenas of an in-memory archive, without copying. Returns the number of
+   * arenas in use, only the first iovcnt of which are stored in iov */
+  int
+  ptar_membuf_iov (ptar_t *tar, struct iovec *iov, int iovcnt);
+  /* Add file `path` as member `name`. Holes found with SEEK_DATA/SEEK_HOLE
+   * are not stored: such a file becomes a GNU sparse member (PTAR_TSPARSE)
+   * holding only its data segments. Sizes are limited to 4 GiB. */
+  int
+  ptar_add_file (ptar_t *tar, const char *name, const char *path);
+  /* Write member `name` to `path`. Holes of a sparse member are recreated by
+   * seeking over them rather than written as zeros. */
+  int
+  ptar_extract (ptar_t *tar, const char *name, const char *path);
+  /* Compressing writer on `threads` threads (0: one per core). Input is cut
+   * into PTAR_CODEC_BLOCK blocks compressed independently and written in
+   * order as concatenated gzip members / zstd frames. */
+  int
+  ptar_open_compressed_mt (ptar_t *tar, ptar_t *lower, int codec, int threads);
 #else
 int ptar_open(ptar_t *tar, const char *filename, const char *mode);
 #endif
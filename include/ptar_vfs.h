@@ -0,0 +1,99 @@
+/*
+ * ptar_vfs.h
+ *  Module     : ptar
+ *  Description: Directory tree view of an archive. The tree is built with
+ *               one scan of the headers, from PTAR_TDIR entries and from the
+ *               parents implied by member names; stat, opendir and readdir
+ *               then work without reading the archive.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDE_PTAR_VFS_H_
+#define INCLUDE_PTAR_VFS_H_
+
+#include <ptar.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  struct ptar_vfs_node;
+
+  typedef struct
+  {
+    ptar_t *tar;
+    /* Node 0 is the root */
+    struct ptar_vfs_node *node;
+    unsigned nnodes;
+    unsigned capacity;
+    /* Hash table of (parent, name) -> node + 1 */
+    unsigned *slot;
+    unsigned nslots;
+    /* Node names, NUL terminated, one after the other */
+    char *names;
+    unsigned names_len;
+    unsigned names_cap;
+  } ptar_vfs_t;
+
+  typedef struct
+  {
+    /* Last path component, "" for the root. Valid until ptar_vfs_close */
+    const char *name;
+    unsigned type;
+    unsigned mode;
+    unsigned owner;
+    /* Logical size, as ptar_read_header reports it */
+    unsigned size;
+    unsigned mtime;
+    /* Header offset, for ptar_seek, when the entry has a header */
+    unsigned offset;
+    /* Directory known only from the names below it: no header, no offset */
+    int implied;
+  } ptar_stat_t;
+
+  typedef struct
+  {
+    ptar_vfs_t *vfs;
+    /* Next child node, 0 at the end */
+    unsigned next;
+  } ptar_dir_t;
+
+  /* Build the tree of the archive behind tar. Leading "/" and "./" of member
+   * names are dropped; a name stored more than once shows its last entry, as
+   * tar extracts it. The tree is a snapshot: open it again after writing. */
+  int
+  ptar_vfs_open (ptar_vfs_t *vfs, ptar_t *tar);
+  void
+  ptar_vfs_close (ptar_vfs_t *vfs);
+  /* Resolve path one component at a time, each one hash lookup. Links are
+   * reported as they are, not followed. */
+  int
+  ptar_stat (ptar_vfs_t *vfs, const char *path, ptar_stat_t *st);
+  /* PTAR_ENOTDIR if path is not a directory */
+  int
+  ptar_opendir (ptar_vfs_t *vfs, const char *path, ptar_dir_t *dir);
+  /* Next entry in archive order, PTAR_ENOTFOUND after the last one */
+  int
+  ptar_readdir (ptar_dir_t *dir, ptar_stat_t *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDE_PTAR_VFS_H_ */
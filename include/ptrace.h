@@ -22,6 +22,7 @@
 
 #ifndef INCLUDE_PTRACE_H_
 #define INCLUDE_PTRACE_H_
+#include <stdio.h>
 #include <time.h>
 #include <string.h>
 
@@ -37,63 +38,365 @@
  *     LOG_LEVEL is defined to DEBUG_LEVEL, all other logs will also be recorded.
  *     This will control information that logged.
  *
+ *     LOG_LEVEL is the ceiling compiled in. Under it, the runtime level decides: set it with
+ *     ptrace_set_level, $PTRACE_LEVEL at startup, a signal (ptrace_level_signal) or a control
+ *     file (ptrace_level_watch). A skipped line costs one relaxed load and a branch.
+ *
+ *     ptrace_control sets the level of some call sites only, by file and function: e.g. DEBUG for
+ *     the ptar read path while everything else stays at ERROR.
+ *
  * [Log Files]
- * ERR_STREAM macro is used to define the stream where errors will be logged
- * If this macro is not defined, errors will be put to stderr.
+ * Lines go to a sink owned by ptrace: one file descriptor, kept open, with a write buffer in
+ * front of it. ptrace_init chooses the file (NULL for stderr); without it the first line opens
+ * the file named by the PTRACE_LOG_FILE environment variable, or PTRACE_LOG_FILE below.
+ * Buffered lines are written when the buffer fills, on ptrace_flush, on ptrace_shutdown and at
+ * exit.
+ *
+ * [Binary Logs]
+ * ptrace_init_binary writes records instead of text: each call site is described once (file,
+ * function, line, format and argument types), and a line is stored as the site's id, a
+ * timestamp and the raw argument bytes. Nothing is formatted while logging; ptrace-decode (or
+ * ptrace_decode) renders the text later.
+ *
+ * [Timestamps]
+ * Lines are stamped to the microsecond. The default clock is CLOCK_MONOTONIC offset to the wall
+ * clock; ptrace_clock picks CLOCK_MONOTONIC_COARSE (cheapest, timer tick resolution) or a
+ * calibrated TSC instead. The offset follows the wall clock when it steps forward, checked once a
+ * second; a step back is not followed, so stamps never go back and lines keep their order. The
+ * date and time part is rendered once a second per thread.
  *
  * Following could be the way of using this
  *
  * #define LOG_LEVEL ERROR_LEVEL
- * #ifdef ERR_STREAM
- * #undef ERR_STREAM
- * #endif
- * #define LOG_FILE_PATH "error.log"
- * #define ERR_STREAM fopen(LOG_FILE_PATH, "a+")
  *  ...
+ *  ptrace_init ("error.log");
  *  PTrace(ERROR_LEVEL, "Failed to open file : %s, Error : %d", filename, err=errno);
+ *  ...
+ *  ptrace_shutdown ();
  *
  */
-static inline char *
-timenow ();
 
+/* Basename of the file being compiled, worked out at compile time: given
+ * by the build (-DPTRACE_FILE_NAME=\"name.c\", as CMakeLists.txt does for
+ * this library), the compiler's __FILE_NAME__, or in C++ a constexpr scan
+ * of __FILE__. Otherwise a call site finds it when it is first reached. */
+#if !defined(PTRACE_FILE_NAME) && defined(__FILE_NAME__)
+#define PTRACE_FILE_NAME __FILE_NAME__
+#endif
+#if !defined(PTRACE_FILE_NAME) && defined(__cplusplus) && __cplusplus >= 201103L
+constexpr const char *
+ptrace_basename (const char *p, const char *base)
+{
+  return *p == '\0' ? base : ptrace_basename (p + 1, *p == '/' ? p + 1 : base);
+}
+#define PTRACE_FILE_NAME ptrace_basename (__FILE__, __FILE__)
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifdef PTRACE_FILE_NAME
+#define _FILE PTRACE_FILE_NAME
+#define PTRACE_SITE_BASE PTRACE_FILE_NAME
+#else
 #define _FILE strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__
+#define PTRACE_SITE_BASE NULL
+#endif
 
 #define NO_LOG          0x00
 #define ERROR_LEVEL     0x01
 #define INFO_LEVEL      0x02
 #define DEBUG_LEVEL     0x03
 
-#define NEWLINE     "\n"
-const char* LOG_TAG[] =
-  { "", "ERROR", "INFO", "DEBUG" };
-
-#ifndef ERR_STREAM
-#define ERR_STREAM stderr
-#endif
 #ifndef LOG_LEVEL
 #define LOG_LEVEL   DEBUG_LEVEL
 #endif
 
-#define PRINT_FUNCTION(stream, format, ...)      fprintf(stream, format, __VA_ARGS__)
-#define LOG_FMT             "%s | %-7s | %-15s | %s:%d | "
-#define LOG_ARGS(logLevel)   timenow(), LOG_TAG[logLevel], _FILE, __FUNCTION__, __LINE__
+/* File the sink opens when ptrace_init was not called */
+#ifndef PTRACE_LOG_FILE
+#define PTRACE_LOG_FILE "error.log"
+#endif
+/* Size of the sink's write buffer */
+#ifndef PTRACE_BUFSIZE
+#define PTRACE_BUFSIZE (64 * 1024)
+#endif
+/* Longest line; longer ones are cut */
+#ifndef PTRACE_LINE_MAX
+#define PTRACE_LINE_MAX 1024
+#endif
+/* Lines a thread's async ring holds when ptrace_async_start is given 0 */
+#ifndef PTRACE_RING_SIZE
+#define PTRACE_RING_SIZE 256
+#endif
+
+/* What a caller does when the async ring is full */
+enum
+{
+  /* Wait for the flusher to make room */
+  PTRACE_BLOCK,
+  /* Drop the line being logged */
+  PTRACE_DROP_NEWEST,
+  /* Drop the oldest line not yet written */
+  PTRACE_DROP_OLDEST
+};
+
+/* Where line timestamps come from, see ptrace_clock */
+enum
+{
+  /* CLOCK_MONOTONIC offset to the wall clock */
+  PTRACE_CLOCK_MONOTONIC,
+  /* CLOCK_MONOTONIC_COARSE: no TSC read, timer tick resolution */
+  PTRACE_CLOCK_COARSE,
+  /* The CPU's time stamp counter, calibrated against CLOCK_MONOTONIC.
+   * x86-64 with an invariant TSC only */
+  PTRACE_CLOCK_TSC
+};
+
+/* Most arguments a binary record stores; sites with more are formatted as
+ * text on the calling thread */
+#ifndef PTRACE_MAX_ARGS
+#define PTRACE_MAX_ARGS 16
+#endif
+
+/* nargs of a site whose lines are stored as text in a binary log */
+#define PTRACE_SITE_TEXT 0xff
+
+/* A PTrace call site. The macro defines one, statically, per call; it is
+ * registered the first time the call logs */
+typedef struct ptrace_site
+{
+  const char *file;
+  /* Basename of file, NULL until registration if the compiler can not tell */
+  const char *base;
+  const char *func;
+  int line;
+  int level;
+  const char *fmt;
+  /* Filled in on registration */
+  unsigned id;
+  /* " | LEVEL | file | func:line | ", the text line's prefix after the
+   * timestamp */
+  const char *tail;
+  unsigned tail_len;
+  unsigned char nargs;
+  unsigned char types[PTRACE_MAX_ARGS];
+  /* Binary log the site was last described in */
+  unsigned gen;
+  /* Level set for the site by a ptrace_control rule (-1: none), as of the
+   * rules' generation rule_gen */
+  int rule_level;
+  unsigned rule_gen;
+  /* PTraceEvery: calls so far */
+  unsigned long hits;
+  /* PTraceRate: when the bucket is full again (ns), lines dropped */
+  unsigned long long full_at;
+  unsigned long suppressed;
+  /* PTraceFold: hash of the last line, repeats of it not written */
+  unsigned long long last_hash;
+  unsigned long repeats;
+  struct ptrace_site *next;
+} ptrace_site_t;
 
+/* A static call site of level at this line. nargs: 0, or PTRACE_SITE_TEXT
+ * for a site whose lines are text already */
+#define PTRACE_SITE_INIT(logLevel, message, nargs) \
+  { __FILE__, PTRACE_SITE_BASE, __FUNCTION__, __LINE__, logLevel, message, 0, \
+      0, 0, nargs, { 0 }, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
 
-#define PTrace(logLevel, message, args...) if(NO_LOG != logLevel && logLevel <= LOG_LEVEL) PRINT_FUNCTION(ERR_STREAM, LOG_FMT message NEWLINE, LOG_ARGS(logLevel), ## args)
+/* A line written in place, see ptrace_line_begin */
+typedef struct
+{
+  /* The message goes at text + len, cap bytes at most */
+  char *text;
+  unsigned len;
+  unsigned cap;
+  /* Where the line is written */
+  ptrace_site_t *site;
+  void *slot;
+  char *buf;
+  unsigned head;
+  int binary;
+  int async;
+  unsigned gen;
+  char local[PTRACE_LINE_MAX];
+} ptrace_line_t;
 
-static inline char*
-timenow ()
+typedef struct
 {
-  static char buffer[64];
-  time_t rawtime;
-  struct tm *timeinfo;
+  /* Lines written by the async flusher */
+  unsigned long long written;
+  unsigned long long dropped_newest;
+  unsigned long long dropped_oldest;
+  /* Calls that had to wait for room, under PTRACE_BLOCK */
+  unsigned long long blocked;
+} ptrace_stats_t;
+
+/* Runtime level, see ptrace_set_level. Read with one relaxed load */
+extern int ptrace_level;
+
+/* Whether a line of level is logged: the compile-time checks fold away, the
+ * runtime one is a relaxed load and a branch predicted not taken */
+#define PTRACE_ENABLED(logLevel) \
+  (NO_LOG != (logLevel) && (logLevel) <= LOG_LEVEL \
+      && __builtin_expect ((logLevel) \
+          <= __atomic_load_n (&ptrace_level, __ATOMIC_RELAXED), 0))
 
-  time (&rawtime);
-  timeinfo = localtime (&rawtime);
+/* Generation of the ptrace_control rules; 0 while there never were any */
+extern unsigned ptrace_rules_gen;
 
-  strftime (buffer, 64, "%Y-%m-%d %H:%M:%S", timeinfo);
+int
+ptrace_site_check (ptrace_site_t *site, unsigned gen);
 
-  return buffer;
+/* Whether site logs, once its level passed PTRACE_ENABLED: always, unless
+ * rules were set. ptrace_level is then the highest level any rule allows,
+ * and the site's own level decides */
+static inline int
+ptrace_site_on (ptrace_site_t *site)
+{
+  unsigned gen = __atomic_load_n (&ptrace_rules_gen, __ATOMIC_ACQUIRE);
+  return __builtin_expect (gen == 0, 1) || ptrace_site_check (site, gen);
 }
 
+/* Run call for the static site of this line when logLevel is enabled and
+ * admit, evaluated after the level checks, holds */
+#define PTRACE_CALL(logLevel, message, nargs, admit, call) \
+  do \
+    { \
+      if (PTRACE_ENABLED(logLevel)) \
+        { \
+          static ptrace_site_t _ptrace_site = \
+            PTRACE_SITE_INIT(logLevel, message, nargs); \
+          if (ptrace_site_on (&_ptrace_site) && (admit)) \
+            { \
+              call; \
+            } \
+        } \
+    } \
+  while (0)
+
+#define PTrace(logLevel, message, args...) \
+  PTRACE_CALL(logLevel, message, 0, 1, \
+              ptrace_log (&_ptrace_site, message, ## args))
+
+/* Log 1 of every n calls of this line */
+#define PTraceEvery(logLevel, n, message, args...) \
+  PTRACE_CALL(logLevel, message, 0, ptrace_every (&_ptrace_site, n), \
+              ptrace_log (&_ptrace_site, message, ## args))
+
+/* Log at most per_sec lines a second from this line, in bursts of up to
+ * burst lines (a token bucket). The count of dropped lines is written ahead
+ * of the next line let through, or on ptrace_flush */
+#define PTraceRate(logLevel, per_sec, burst, message, args...) \
+  PTRACE_CALL(logLevel, message, 0, \
+              ptrace_rate (&_ptrace_site, per_sec, burst), \
+              ptrace_log (&_ptrace_site, message, ## args))
+
+/* Like PTrace, but a line the same as this site's last one is only
+ * counted: "last message repeated N times" is written ahead of the next
+ * different line, or on ptrace_flush */
+#define PTraceFold(logLevel, message, args...) \
+  PTRACE_CALL(logLevel, message, 0, 1, \
+              ptrace_log_fold (&_ptrace_site, message, ## args))
+
+static inline int
+ptrace_every (ptrace_site_t *site, unsigned long n)
+{
+  return __atomic_fetch_add (&site->hits, 1, __ATOMIC_RELAXED) % (n ? n : 1)
+      == 0;
+}
+
+int
+ptrace_rate (ptrace_site_t *site, unsigned per_sec, unsigned burst);
+
+/* Send lines to path (appended to), or to stderr if path is NULL. Lines
+ * buffered for the previous sink are written to it first. Returns 0, or -1
+ * with errno set if path can not be opened. */
+int
+ptrace_init (const char *path);
+/* Like ptrace_init, but the file gets binary records, see [Binary Logs].
+ * The file is truncated. */
+int
+ptrace_init_binary (const char *path);
+/* Render a binary log as text lines. Returns 0, or -1 if in is not a
+ * binary log or is cut short (the lines before the damage are written). */
+int
+ptrace_decode (FILE *in, FILE *out);
+/* Write out the buffered lines and close the sink. A later line opens the
+ * default sink again. */
+void
+ptrace_shutdown (void);
+/* Write out the buffered lines */
+void
+ptrace_flush (void);
+/* Async mode: each thread formats its lines into its own lock-free ring of
+ * `records` lines (0: PTRACE_RING_SIZE, rounded up to a power of 2),
+ * created on its first line, and returns. A background thread merges the
+ * rings by timestamp and writes the lines out in batches with writev. policy
+ * says what happens when a ring is full. ptrace_flush waits for the rings to
+ * be written out; ptrace_async_stop and ptrace_shutdown write them out and
+ * stop the thread. */
+int
+ptrace_async_start (unsigned records, int policy);
+void
+ptrace_async_stop (void);
+void
+ptrace_stats (ptrace_stats_t *st);
+/* Runtime level: lines above it are skipped (LOG_LEVEL still decides what
+ * is compiled in). Starts at DEBUG_LEVEL, or $PTRACE_LEVEL ("0" to "3" or
+ * "none", "error", "info", "debug"). */
+void
+ptrace_set_level (int level);
+int
+ptrace_get_level (void);
+/* Cycle the runtime level (ERROR, INFO, DEBUG, ERROR, ...) on each signo,
+ * e.g. SIGUSR2. Returns sigaction's result. */
+int
+ptrace_level_signal (int signo);
+/* Start a thread that applies the file at path, one ptrace_control command
+ * per line, whenever it changes, checked every interval_ms (0: 1000). The
+ * file's rules replace the rules in force. NULL stops it. Returns 0, or -1
+ * with errno set. */
+int
+ptrace_level_watch (const char *path, unsigned interval_ms);
+/* Set the level of the call sites matching a rule, like Linux's
+ * dynamic_debug, e.g. "file ptar_index.c level debug", "file ptar_*.c func
+ * ptar_read level info", "file ptrace_test.cpp level none". Sites whose
+ * file (basename or path) and function match the shell patterns log up to
+ * that level, whatever the runtime level; the last matching rule wins.
+ * "level default" removes the rule; a bare level ("info") sets the runtime
+ * level. Returns 0, or -1 with errno EINVAL if cmd can not be parsed. */
+int
+ptrace_control (const char *cmd);
+/* Write the call sites registered so far (those that reached a level
+ * check) to out: "file:line [function] level on|off "format"" */
+void
+ptrace_list_sites (FILE *out);
+/* Stamp lines from source. The wall clock offset is taken again (a step
+ * back included), and the TSC calibrated (for about 20ms). Choose it before threads start logging:
+ * lines stamped around a switch may be out of order. Returns 0, or -1 with
+ * errno ENOTSUP if source is not available here. */
+int
+ptrace_clock (int source);
+void
+ptrace_log (ptrace_site_t *site, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void
+ptrace_log_fold (ptrace_site_t *site, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+/* For front-ends that format lines themselves (ptrace.hpp): write the prefix
+ * of a line of site, in place in the async ring when it is on. The caller
+ * appends the message at line->text + line->len, up to line->cap bytes, and
+ * ends the line with ptrace_line_end. The site's nargs must be
+ * PTRACE_SITE_TEXT: in a binary log its lines are kept as text. */
+void
+ptrace_line_begin (ptrace_site_t *site, ptrace_line_t *line);
+void
+ptrace_line_end (ptrace_line_t *line);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* INCLUDE_PTRACE_H_ */
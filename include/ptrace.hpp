@@ -0,0 +1,352 @@
+/*
+ * ptrace.hpp
+ *  Module     : ptrace
+ *  Description: Type safe C++ front-end of ptrace.
+ *
+ *               PLog(INFO_LEVEL, "read {} bytes of {}", n, name);
+ *
+ *               Fields are "{}", "{{" and "}}" are braces. The format is
+ *               checked at compile time: PLog fails to compile when the
+ *               number of fields and arguments differ, or a brace is left
+ *               unmatched. At run time the text between fields is found
+ *               with one strpbrk per field. Each argument is written by the
+ *               encoder of its type, straight into the line (in the async
+ *               ring, when on): no printf format is interpreted. Add a type by
+ *               specializing ptrace::encoder:
+ *
+ *               namespace ptrace {
+ *               template <> struct encoder<point>
+ *               {
+ *                 static void put (writer &w, const point &p)
+ *                 { w.put ('('); w.put (p.x); w.put (','); w.put (p.y); w.put (')'); }
+ *               }; }
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDE_PTRACE_HPP_
+#define INCLUDE_PTRACE_HPP_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include "ptrace.h"
+
+namespace ptrace
+{
+  /* Appends to a line, cutting what does not fit */
+  class writer
+  {
+  public:
+    explicit
+    writer (ptrace_line_t &line) :
+        line_ (line)
+    {
+    }
+
+    void
+    put (const char *p, std::size_t n)
+    {
+      std::size_t room = line_.cap - line_.len;
+      n = n < room ? n : room;
+      std::memcpy (line_.text + line_.len, p, n);
+      line_.len += n;
+    }
+
+    void
+    put (char c)
+    {
+      if (line_.len < line_.cap)
+        {
+          line_.text[line_.len++] = c;
+        }
+    }
+
+    template <typename T>
+    void
+    put (const T &v);
+
+  private:
+    ptrace_line_t &line_;
+  };
+
+  /* Writes a T; specialize it for more types */
+  template <typename T, typename Enable = void>
+  struct encoder;
+
+  template <>
+  struct encoder<bool>
+  {
+    static void
+    put (writer &w, bool v)
+    {
+      if (v)
+        {
+          w.put ("true", 4);
+        }
+      else
+        {
+          w.put ("false", 5);
+        }
+    }
+  };
+
+  template <>
+  struct encoder<char>
+  {
+    static void
+    put (writer &w, char c)
+    {
+      w.put (c);
+    }
+  };
+
+  template <typename T>
+  struct encoder<T, typename std::enable_if<std::is_integral<T>::value
+      && !std::is_same<T, bool>::value && !std::is_same<T, char>::value>::type>
+  {
+    static void
+    put (writer &w, T v)
+    {
+      char digits[24];
+      char *p = digits + sizeof(digits);
+      bool negative = below_zero (v, std::is_signed<T> ());
+      /* Unsigned, so the most negative value negates too */
+      typename std::make_unsigned<T>::type u = v;
+
+      if (negative)
+        {
+          u = 0 - u;
+        }
+      do
+        {
+          *--p = '0' + u % 10;
+          u /= 10;
+        }
+      while (u);
+      if (negative)
+        {
+          *--p = '-';
+        }
+      w.put (p, digits + sizeof(digits) - p);
+    }
+
+  private:
+    static bool
+    below_zero (T v, std::true_type)
+    {
+      return v < 0;
+    }
+
+    static bool
+    below_zero (T, std::false_type)
+    {
+      return false;
+    }
+  };
+
+  template <typename T>
+  struct encoder<T, typename std::enable_if<std::is_enum<T>::value>::type>
+  {
+    static void
+    put (writer &w, T v)
+    {
+      encoder<typename std::underlying_type<T>::type>::put (w,
+          static_cast<typename std::underlying_type<T>::type> (v));
+    }
+  };
+
+  /* Shortest text that reads back the same: the one conversion left to the
+   * C library. digits10 digits read back most values; max_digits10 all */
+  template <typename T>
+  struct encoder<T,
+      typename std::enable_if<std::is_floating_point<T>::value>::type>
+  {
+    static void
+    put (writer &w, T v)
+    {
+      char text[48];
+      int n = 0;
+
+      for (int digits = std::numeric_limits<T>::digits10;
+          digits <= std::numeric_limits<T>::max_digits10; digits++)
+        {
+          n = std::snprintf (text, sizeof(text), "%.*Lg", digits,
+                             static_cast<long double> (v));
+          if (n <= 0 || static_cast<T> (std::strtold (text, NULL)) == v
+              || v != v)
+            {
+              break;
+            }
+        }
+      w.put (text, n > 0 ? n : 0);
+    }
+  };
+
+  template <>
+  struct encoder<const char*>
+  {
+    static void
+    put (writer &w, const char *s)
+    {
+      if (s)
+        {
+          w.put (s, std::strlen (s));
+        }
+      else
+        {
+          w.put ("(null)", 6);
+        }
+    }
+  };
+
+  template <>
+  struct encoder<char*> : encoder<const char*>
+  {
+  };
+
+  template <>
+  struct encoder<std::string>
+  {
+    static void
+    put (writer &w, const std::string &s)
+    {
+      w.put (s.data (), s.size ());
+    }
+  };
+
+  template <typename T>
+  struct encoder<T*>
+  {
+    static void
+    put (writer &w, const T *p)
+    {
+      char digits[2 + 2 * sizeof(p)];
+      char *at = digits + sizeof(digits);
+      std::uintptr_t v = reinterpret_cast<std::uintptr_t> (p);
+
+      do
+        {
+          *--at = "0123456789abcdef"[v & 15];
+          v >>= 4;
+        }
+      while (v);
+      *--at = 'x';
+      *--at = '0';
+      w.put (at, digits + sizeof(digits) - at);
+    }
+  };
+
+  template <typename T>
+  void
+  writer::put (const T &v)
+  {
+    encoder<typename std::decay<T>::type>::put (*this, v);
+  }
+
+  namespace detail
+  {
+    /* Fields in fmt, -1 if a brace is unmatched */
+    constexpr int
+    count_fields (const char *fmt, int n = 0)
+    {
+      return *fmt == '\0' ? n
+          : (fmt[0] == '{' && fmt[1] == '{') || (fmt[0] == '}' && fmt[1] == '}')
+              ? count_fields (fmt + 2, n)
+          : fmt[0] == '{' && fmt[1] == '}' ? count_fields (fmt + 2, n + 1)
+          : fmt[0] == '{' || fmt[0] == '}' ? -1
+          : count_fields (fmt + 1, n);
+    }
+
+    /* sizeof(arity (args...)) - 1 is the number of arguments; never called */
+    template <typename ... T>
+    char
+    (&arity (const T &...))[sizeof...(T) + 1];
+
+    /* Write fmt up to its next field. Returns what follows the field, or
+     * the end of fmt */
+    inline const char *
+    literal (writer &w, const char *fmt)
+    {
+      const char *p;
+
+      for (;;)
+        {
+          p = std::strpbrk (fmt, "{}");
+          if (NULL == p)
+            {
+              w.put (fmt, std::strlen (fmt));
+              return fmt + std::strlen (fmt);
+            }
+          w.put (fmt, p - fmt);
+          if (p[0] == '{' && p[1] == '}')
+            {
+              return p + 2;
+            }
+          /* "{{" or "}}" */
+          w.put (p[0]);
+          fmt = p[1] == p[0] ? p + 2 : p + 1;
+        }
+    }
+
+    inline void
+    render (writer &w, const char *fmt)
+    {
+      literal (w, fmt);
+    }
+
+    template <typename T, typename ... Rest>
+    void
+    render (writer &w, const char *fmt, const T &v, const Rest &... rest)
+    {
+      fmt = literal (w, fmt);
+      w.put (v);
+      render (w, fmt, rest...);
+    }
+  }
+
+  /* A line of site. PLog checks the format and gives the site */
+  template <int Level, typename ... Args>
+  void
+  log (ptrace_site_t &site, const char *fmt, const Args &... args)
+  {
+    static_assert (Level >= ERROR_LEVEL && Level <= DEBUG_LEVEL,
+                   "ptrace::log: no such level");
+    ptrace_line_t line;
+    ptrace_line_begin (&site, &line);
+    writer w (line);
+    detail::render (w, fmt, args...);
+    ptrace_line_end (&line);
+  }
+}
+
+#define PLog(logLevel, message, args...) \
+  do \
+    { \
+      static_assert (::ptrace::detail::count_fields (message) \
+          == sizeof(::ptrace::detail::arity (args)) - 1, \
+          "PLog: the format's {} fields do not match the arguments"); \
+      PTRACE_CALL(logLevel, message, PTRACE_SITE_TEXT, 1, \
+                  ::ptrace::log<logLevel> (_ptrace_site, message, ## args)); \
+    } \
+  while (0)
+
+#endif /* INCLUDE_PTRACE_HPP_ */
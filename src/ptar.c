@@ -20,6 +20,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. 
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <string.h>
 
 #include <sys/types.h>
@@ -27,27 +30,13 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
-#include "ptar.h"
-
-typedef struct
-{
-  char name[100];
-  char mode[8];
-  char owner[8];
-  char group[8];
-  char size[12];
-  char mtime[12];
-  char checksum[8];
-  char type;
-  char linkname[100];
-  char _padding[255];
-} ptar_raw_header_t;
+#include <limits.h>
+#include "ptar_private.h"
 
-static unsigned
-round_up (unsigned n, unsigned incr)
-{
-  return n + (incr - n % incr) % incr;
-}
+static void
+punch_hole (ptar_t *tar, unsigned pos, unsigned len);
+static void
+trim_end (ptar_t *tar, unsigned end);
 
 static unsigned
 checksum (const ptar_raw_header_t* rh)
@@ -66,34 +55,21 @@ checksum (const ptar_raw_header_t* rh)
   return res;
 }
 
-static int
-tread (ptar_t *tar, void *data, unsigned size)
-{
-  int err = tar->read (tar, data, size);
-  tar->pos += size;
-  return err;
-}
-
-static int
-twrite (ptar_t *tar, const void *data, unsigned size)
-{
-  int err = tar->write (tar, data, size);
-  tar->pos += size;
-  return err;
-}
-
 static int
 write_null_bytes (ptar_t *tar, int n)
 {
-  int i, err;
-  char nul = '\0';
-  for (i = 0; i < n; i++)
+  static const char nul[512];
+  int err, len;
+  /* Write padding a record at a time so backends see one call per record */
+  while (n > 0)
     {
-      err = twrite (tar, &nul, 1);
+      len = n < (int) sizeof(nul) ? n : (int) sizeof(nul);
+      err = twrite (tar, nul, len);
       if (err)
         {
           return err;
         }
+      n -= len;
     }
   return PTAR_ESUCCESS;
 }
@@ -152,6 +128,19 @@ header_to_raw (ptar_raw_header_t *rh, const ptar_header_t *h)
   return PTAR_ESUCCESS;
 }
 
+int
+ptar_header_to_raw (ptar_raw_header_t *rh, const ptar_header_t *h)
+{
+  return header_to_raw (rh, h);
+}
+
+void
+ptar_raw_seal (ptar_raw_header_t *rh)
+{
+  sprintf (rh->checksum, "%06o", checksum (rh));
+  rh->checksum[7] = ' ';
+}
+
 const char*
 ptar_strerror (int err)
 {
@@ -175,6 +164,12 @@ ptar_strerror (int err)
       return "null record";
     case PTAR_ENOTFOUND:
       return "file not found";
+    case PTAR_ENOTSUP:
+      return "not supported";
+    case PTAR_ECORRUPT:
+      return "corrupt data";
+    case PTAR_ENOTDIR:
+      return "not a directory";
     }
   return "unknown error";
 }
@@ -182,6 +177,16 @@ ptar_strerror (int err)
 int
 ptar_close (ptar_t *tar)
 {
+  ptar_dict_free (tar->dict);
+  ptar_dict_free (tar->dict_cache);
+  ptar_dicts_free (tar->dicts);
+  ptar_dedup_free (tar->dedup);
+  ptar_index_free (tar->index);
+  ptar_frame_forget (tar);
+  tar->dict = tar->dict_cache = NULL;
+  tar->dicts = NULL;
+  tar->dedup = NULL;
+  tar->index = NULL;
   return tar->close (tar);
 }
 
@@ -189,7 +194,11 @@ int
 ptar_seek (ptar_t *tar, unsigned pos)
 {
   int err = tar->seek (tar, pos);
-  tar->pos = pos;
+  /* A failed seek leaves the position where it was */
+  if (err == PTAR_ESUCCESS)
+    {
+      tar->pos = pos;
+    }
   return err;
 }
 
@@ -207,7 +216,7 @@ ptar_next (ptar_t *tar)
   int err, n;
   ptar_header_t h;
   /* Load header */
-  err = ptar_read_header (tar, &h);
+  err = ptar_load_header (tar, &h);
   if (err)
     {
       return err;
@@ -222,6 +231,10 @@ ptar_find (ptar_t *tar, const char *name, ptar_header_t *h)
 {
   int err;
   ptar_header_t header;
+  if (tar->index)
+    {
+      return ptar_index_find (tar, name, h);
+    }
   /* Start at beginning */
   err = ptar_rewind (tar);
   if (err)
@@ -229,13 +242,13 @@ ptar_find (ptar_t *tar, const char *name, ptar_header_t *h)
       return err;
     }
   /* Iterate all files until we hit an error or find the file */
-  while ((err = ptar_read_header (tar, &header)) == PTAR_ESUCCESS)
+  while ((err = ptar_load_header (tar, &header)) == PTAR_ESUCCESS)
     {
-      if (!strcmp (header.name, name))
+      if (header.type != PTAR_TDEAD && !strcmp (header.name, name))
         {
           if (h)
             {
-              *h = header;
+              return ptar_read_header (tar, h);
             }
           return PTAR_ESUCCESS;
         }
@@ -251,6 +264,31 @@ ptar_find (ptar_t *tar, const char *name, ptar_header_t *h)
 
 int
 ptar_read_header (ptar_t *tar, ptar_header_t *h)
+{
+  int err;
+  unsigned pos = tar->pos;
+  err = ptar_load_header (tar, h);
+  if (err)
+    {
+      return err;
+    }
+  /* Framed and sparse members read like a regular file of their logical size */
+  if (h->type == PTAR_TFRAMED || h->type == PTAR_TSPARSE)
+    {
+      err = h->type == PTAR_TSPARSE ? ptar_sparse_size (tar, pos, &h->size)
+          : ptar_frame_size (tar, pos + sizeof(ptar_raw_header_t), h->size,
+                             &h->size);
+      if (err == PTAR_ESUCCESS)
+        {
+          err = ptar_seek (tar, pos);
+        }
+      tar->last_header = pos;
+    }
+  return err;
+}
+
+int
+ptar_load_header (ptar_t *tar, ptar_header_t *h)
 {
   int err;
   ptar_raw_header_t rh;
@@ -269,31 +307,56 @@ ptar_read_header (ptar_t *tar, ptar_header_t *h)
       return err;
     }
   /* Load raw header into header struct and return */
-  return raw_to_header (h, &rh);
+  err = raw_to_header (h, &rh);
+  /* Extension records of a sparse map come before the data */
+  if (err == PTAR_ESUCCESS && h->type == PTAR_TSPARSE)
+    {
+      err = ptar_sparse_stored (tar, &rh, &h->size);
+    }
+  return err;
 }
 
 int
 ptar_read_data (ptar_t *tar, void *ptr, unsigned size)
 {
   int err;
+  ptar_header_t h;
   /* If we have no remaining data then this is the first read, we get the size,
    * set the remaining data and seek to the beginning of the data */
   if (tar->remaining_data == 0)
     {
-      ptar_header_t h;
       /* Read header */
       err = ptar_read_header (tar, &h);
       if (err)
         {
           return err;
         }
-      /* Seek past header and init remaining data */
-      err = ptar_seek (tar, tar->pos + sizeof(ptar_raw_header_t));
+      tar->remaining_data = h.size;
+      /* Seek past header, except for framed and sparse members (see below) */
+      if (h.type != PTAR_TFRAMED && h.type != PTAR_TSPARSE)
+        {
+          err = ptar_seek (tar, tar->pos + sizeof(ptar_raw_header_t));
+          if (err)
+            {
+              return err;
+            }
+        }
+    }
+  /* Framed and sparse members are read range by range while the position
+   * stays on their header; regular members are read in place */
+  if (tar->pos == tar->last_header)
+    {
+      err = ptar_read_header (tar, &h);
+      if (err == PTAR_ESUCCESS)
+        {
+          err = ptar_read_range (tar, h.size - tar->remaining_data, ptr, size);
+        }
       if (err)
         {
           return err;
         }
-      tar->remaining_data = h.size;
+      tar->remaining_data -= size;
+      return PTAR_ESUCCESS;
     }
   /* Read data */
   err = tread (tar, ptr, size);
@@ -311,6 +374,50 @@ ptar_read_data (ptar_t *tar, void *ptr, unsigned size)
   return PTAR_ESUCCESS;
 }
 
+int
+ptar_read_range (ptar_t *tar, unsigned offset, void *ptr, unsigned size)
+{
+  int err;
+  ptar_header_t h;
+  unsigned pos = tar->pos;
+  unsigned data_pos = pos + sizeof(ptar_raw_header_t);
+
+  err = ptar_load_header (tar, &h);
+  if (err)
+    {
+      return err;
+    }
+  if (h.type == PTAR_TFRAMED)
+    {
+      /* Only the frames overlapping the range are decoded */
+      err = ptar_frame_read (tar, data_pos, h.size, offset, ptr, size);
+    }
+  else if (h.type == PTAR_TSPARSE)
+    {
+      /* Holes read as zeros */
+      err = ptar_sparse_read (tar, pos, offset, ptr, size);
+    }
+  else if (offset > h.size || size > h.size - offset)
+    {
+      err = PTAR_EREADFAIL;
+    }
+  else
+    {
+      err = ptar_seek (tar, data_pos + offset);
+      if (err == PTAR_ESUCCESS)
+        {
+          err = tread (tar, ptr, size);
+        }
+    }
+  /* Stay on the header */
+  if (err == PTAR_ESUCCESS)
+    {
+      err = ptar_seek (tar, pos);
+    }
+  tar->last_header = pos;
+  return err;
+}
+
 int
 ptar_write_header (ptar_t *tar, const ptar_header_t *h)
 {
@@ -318,6 +425,15 @@ ptar_write_header (ptar_t *tar, const ptar_header_t *h)
   /* Build raw header and write */
   header_to_raw (&rh, h);
   tar->remaining_data = h->size;
+  if (tar->index && h->type != PTAR_TDEAD)
+    {
+      ptar_index_add (tar, h, tar->pos,
+                      tar->pos + sizeof(rh) + round_up (h->size, 512));
+    }
+  else if (tar->index)
+    {
+      ptar_index_remove (tar, h->name, tar->pos);
+    }
   return twrite (tar, &rh, sizeof(rh));
 }
 
@@ -374,6 +490,211 @@ ptar_finalize (ptar_t *tar)
   return write_null_bytes (tar, sizeof(ptar_raw_header_t) * 2);
 }
 
+int
+ptar_seek_end (ptar_t *tar)
+{
+  int err;
+  unsigned end;
+  ptar_header_t h;
+  if (tar->index)
+    {
+      return ptar_index_end (tar);
+    }
+  /* Hop from header to header; member data is never touched */
+  err = ptar_rewind (tar);
+  if (err)
+    {
+      return err;
+    }
+  do
+    {
+      end = tar->pos;
+      err = ptar_next (tar);
+    }
+  while (err == PTAR_ESUCCESS);
+  /* Either the first null record or the end of an unterminated archive */
+  if (err != PTAR_ENULLRECORD && err != PTAR_EREADFAIL)
+    {
+      return err;
+    }
+  /* A header that failed to read must be a truncated last record */
+  if (err == PTAR_EREADFAIL && PTAR_ESUCCESS == ptar_seek (tar, end)
+      && PTAR_ESUCCESS == ptar_read_header (tar, &h))
+    {
+      return PTAR_EREADFAIL;
+    }
+  tar->remaining_data = 0;
+  tar->last_header = end;
+  return ptar_seek (tar, end);
+}
+
+/* Write a dead header at pos covering [pos, pos + span) */
+static int
+write_dead_header (ptar_t *tar, unsigned pos, unsigned span)
+{
+  int err;
+  ptar_header_t h;
+  memset (&h, 0, sizeof(h));
+  h.type = PTAR_TDEAD;
+  h.size = span - sizeof(ptar_raw_header_t);
+  err = ptar_seek (tar, pos);
+  if (err)
+    {
+      return err;
+    }
+  err = ptar_write_header (tar, &h);
+  tar->remaining_data = 0;
+  return err;
+}
+
+/* Copy [src, src + len) down to dst. dst < src, so a forward copy never
+ * reads bytes it has already overwritten */
+static int
+move_down (ptar_t *tar, unsigned dst, unsigned src, unsigned len)
+{
+  int err;
+  unsigned n;
+  char buf[64 * 1024];
+  while (len > 0)
+    {
+      n = len < sizeof(buf) ? len : sizeof(buf);
+      if ((err = ptar_seek (tar, src)) || (err = tread (tar, buf, n))
+          || (err = ptar_seek (tar, dst)) || (err = twrite (tar, buf, n)))
+        {
+          return err;
+        }
+      src += n;
+      dst += n;
+      len -= n;
+    }
+  return PTAR_ESUCCESS;
+}
+
+int
+ptar_delete (ptar_t *tar, const char *name)
+{
+  int err;
+  unsigned pos;
+  ptar_header_t h;
+
+  err = ptar_find (tar, name, NULL);
+  if (err == PTAR_ESUCCESS)
+    {
+      err = ptar_load_header (tar, &h);
+    }
+  if (err)
+    {
+      return err;
+    }
+  /* Keep the size so readers still hop over the payload */
+  pos = tar->pos;
+  h.type = PTAR_TDEAD;
+  err = ptar_write_header (tar, &h);
+  tar->remaining_data = 0;
+  if (err)
+    {
+      return err;
+    }
+  /* Give the payload blocks back to the file system */
+  punch_hole (tar, pos + sizeof(ptar_raw_header_t), round_up (h.size, 512));
+  return ptar_seek (tar, pos);
+}
+
+int
+ptar_compact (ptar_t *tar, unsigned budget)
+{
+  int err;
+  unsigned dst, src, span, moved = 0;
+  ptar_header_t h;
+
+  /* Members move: an index would point at the wrong headers, and so would
+   * the dictionary offsets */
+  ptar_index_drop (tar);
+  ptar_dicts_free (tar->dicts);
+  tar->dicts = NULL;
+  /* Find the first dead entry. Earlier calls leave a single dead entry over
+   * the gap they opened, so the work resumes there */
+  err = ptar_rewind (tar);
+  while (err == PTAR_ESUCCESS
+      && (err = ptar_load_header (tar, &h)) == PTAR_ESUCCESS
+      && h.type != PTAR_TDEAD)
+    {
+      err = ptar_next (tar);
+    }
+  if (err == PTAR_ENULLRECORD)
+    {
+      return ptar_rewind (tar);
+    }
+  if (err)
+    {
+      return err;
+    }
+  dst = tar->pos;
+  src = dst;
+
+  for (;;)
+    {
+      err = ptar_seek (tar, src);
+      if (err == PTAR_ESUCCESS)
+        {
+          err = ptar_load_header (tar, &h);
+        }
+      if (err == PTAR_ENULLRECORD)
+        {
+          break;
+        }
+      if (err)
+        {
+          return err;
+        }
+      span = sizeof(ptar_raw_header_t) + round_up (h.size, 512);
+      if (h.type == PTAR_TDEAD)
+        {
+          /* Dead entries just widen the gap */
+          src += span;
+          continue;
+        }
+      if (budget && moved >= budget)
+        {
+          break;
+        }
+      err = move_down (tar, dst, src, span);
+      if (err)
+        {
+          return err;
+        }
+      dst += span;
+      src += span;
+      moved += span;
+    }
+
+  if (err == PTAR_ENULLRECORD)
+    {
+      /* Everything is packed: move the end-of-archive marker down */
+      err = ptar_seek (tar, dst);
+      if (err == PTAR_ESUCCESS)
+        {
+          err = ptar_finalize (tar);
+        }
+      if (err == PTAR_ESUCCESS)
+        {
+          punch_hole (tar, tar->pos, src - dst);
+          trim_end (tar, tar->pos);
+          err = ptar_rewind (tar);
+        }
+      return err;
+    }
+  /* Budget used up: cover the remaining gap with one dead entry */
+  err = write_dead_header (tar, dst, src - dst);
+  if (err == PTAR_ESUCCESS)
+    {
+      punch_hole (tar, dst + sizeof(ptar_raw_header_t),
+                  src - dst - sizeof(ptar_raw_header_t));
+      err = ptar_rewind (tar);
+    }
+  return err ? err : 1;
+}
+
 /*
  * function for no posix systems
  */
@@ -402,6 +723,15 @@ static int file_close(ptar_t *tar)
     return PTAR_ESUCCESS;
   }
 
+static void punch_hole(ptar_t *tar, unsigned pos, unsigned len)
+  {
+    /* No hole punching with stdio, the payload just stays dead */
+  }
+
+static void trim_end(ptar_t *tar, unsigned end)
+  {
+  }
+
 int ptar_open(ptar_t *tar, const char *filename, const char *mode)
   {
     int err;
@@ -417,7 +747,7 @@ int ptar_open(ptar_t *tar, const char *filename, const char *mode)
     /* Assure mode is always binary */
     if ( strchr(mode, 'r') ) mode = "rb";
     if ( strchr(mode, 'w') ) mode = "wb";
-    if ( strchr(mode, 'a') ) mode = "ab";
+    if ( strchr(mode, 'a') ) mode = "r+b";
     /* Open file */
     tar->stream = fopen(filename, mode);
     if (!tar->stream)
@@ -425,7 +755,7 @@ int ptar_open(ptar_t *tar, const char *filename, const char *mode)
         return PTAR_EOPENFAIL;
       }
     /* Read first header to check it is valid if mode is `r` */
-    if (*mode == 'r')
+    if (*mode == 'r' && mode[1] != '+')
       {
         err = ptar_read_header(tar, &h);
         if (err != PTAR_ESUCCESS)
@@ -434,6 +764,11 @@ int ptar_open(ptar_t *tar, const char *filename, const char *mode)
             return err;
           }
       }
+    /* Resume after the existing end-of-archive marker if mode is `a` */
+    if (*mode == 'r' && mode[1] == '+')
+      {
+        return ptar_seek_end(tar);
+      }
 
     /* Return ok */
     return PTAR_ESUCCESS;
@@ -445,23 +780,73 @@ int ptar_open(ptar_t *tar, const char *filename, const char *mode)
  * functions using mmap for POSIX systems.
  *
  */
+/* Extend a writable whole-file mapping so that [0, end) can be written.
+ * The file grows geometrically; slack is cut off again by file_close */
+static int
+file_grow (struct mmap_info *info, unsigned end)
+{
+  long page = sysconf (_SC_PAGESIZE);
+  size_t max = UINT_MAX - UINT_MAX % page;
+  size_t len = (size_t) info->size * 2;
+  unsigned char *data;
+
+  if (!info->grow || end > max)
+    {
+      return PTAR_EWRITEFAIL;
+    }
+  if (len < end)
+    {
+      len = end;
+    }
+  len = (len + page - 1) / page * page;
+  if (len > max)
+    {
+      len = max;
+    }
+  if (0 != ftruncate (info->fd, len))
+    {
+      PTrace(ERROR_LEVEL, "Failed to extend file to %lu bytes, Error : %d", (unsigned long) len, errno);
+      return PTAR_EWRITEFAIL;
+    }
+  data = mmap (NULL, len, info->prot, MAP_SHARED, info->fd, 0);
+  if (MAP_FAILED == data)
+    {
+      PTraceRate(ERROR_LEVEL, 10, 20, "mmap failed with err : %d", errno);
+      return PTAR_EWRITEFAIL;
+    }
+  munmap (info->base, info->map_size);
+  info->base = info->data = data;
+  info->map_size = info->size = len;
+  return PTAR_ESUCCESS;
+}
+
 static int
 file_write (ptar_t *tar, const void *data, unsigned size)
 {
-  if (NULL != tar->stream)
+  struct mmap_info *info = tar->stream;
+  if (NULL == info || tar->pos > info->size || !(info->prot & PROT_WRITE))
     {
-      memcpy (((struct mmap_info*) (tar->stream))->data + tar->pos, data, size);
-      return PTAR_ESUCCESS;
+      return PTAR_EWRITEFAIL;
+    }
+  if (size > info->size - tar->pos && file_grow (info, tar->pos + size))
+    {
+      return PTAR_EWRITEFAIL;
     }
-  return PTAR_EWRITEFAIL;
+  memcpy (info->data + tar->pos, data, size);
+  if (tar->pos + size > info->end)
+    {
+      info->end = tar->pos + size;
+    }
+  return PTAR_ESUCCESS;
 }
 
 static int
 file_read (ptar_t *tar, void *data, unsigned size)
 {
-  if (NULL != tar->stream)
+  struct mmap_info *info = tar->stream;
+  if (NULL != info && tar->pos <= info->size && size <= info->size - tar->pos)
     {
-      memcpy (data, ((struct mmap_info*) tar->stream)->data + tar->pos, size);
+      memcpy (data, info->data + tar->pos, size);
       return PTAR_ESUCCESS;
     }
   return PTAR_EREADFAIL;
@@ -470,26 +855,41 @@ file_read (ptar_t *tar, void *data, unsigned size)
 static int
 file_seek (ptar_t *tar, unsigned offset)
 {
-  if ( NULL != tar->stream)
+  struct mmap_info *info = tar->stream;
+  /* ptar_seek moves the position once the seek succeeded */
+  if (NULL == info || offset > info->size)
     {
-      tar->pos = offset;
-      if (tar->pos > ((struct mmap_info*) tar->stream)->size)
-        {
-          return PTAR_ESEEKFAIL;
-        }
-      return PTAR_ESUCCESS;
+      return PTAR_ESEEKFAIL;
     }
-  return PTAR_ESEEKFAIL;
+  return PTAR_ESUCCESS;
 }
 
 static int
 file_close (ptar_t *tar)
 {
-  if ( NULL != tar->stream)
+  struct mmap_info *info = tar->stream;
+  if ( NULL != info)
     {
-      munmap (((struct mmap_info*) tar->stream)->data,
-              ((struct mmap_info*) tar->stream)->size);
-      close (((struct mmap_info*) tar->stream)->fd);
+      /* Caller owned memory regions have no mapping, see ptar_open_memory */
+      if (NULL != info->base)
+        {
+          munmap (info->base, info->map_size);
+        }
+      /* Drop the slack added when the file was created or grown */
+      if (info->grow && info->map_size > info->file_size
+          && info->map_size > info->end)
+        {
+          if (0 != ftruncate (info->fd, info->end > info->file_size ? info->end : info->file_size))
+            {
+              PTrace(ERROR_LEVEL, "Failed to trim file, Error : %d", errno);
+            }
+        }
+      if (info->own_fd)
+        {
+          close (info->fd);
+        }
+      free (info);
+      tar->stream = NULL;
       return PTAR_ESUCCESS;
     }
   return PTAR_EFAILURE;
@@ -497,11 +897,9 @@ file_close (ptar_t *tar)
 int
 fileModeMapper (const int mode)
 {
-  if ( PROT_READ == mode)
+  if ( PROT_READ == (mode & ~PTAR_APPEND))
     return O_RDONLY;
-  if (PROT_WRITE == mode)
-    return (O_RDWR |O_CREAT);
-
+  return (O_RDWR |O_CREAT);
 }
 int
 ptar_open (ptar_t *tar, const char *filename, const int mode)
@@ -520,7 +918,7 @@ ptar_open (ptar_t *tar, const char *filename, const int mode)
   tar->close = file_close;
 
   /* Open file */
-  info = malloc (sizeof(struct mmap_info));
+  info = calloc (1, sizeof(struct mmap_info));
 
   /* Assure that file opened with the correct mode */
 
@@ -528,6 +926,7 @@ ptar_open (ptar_t *tar, const char *filename, const int mode)
   if (info->fd == -1)
     {
       PTrace(ERROR_LEVEL, "Failed to open file : %s, Error : %d", filename, err=errno);
+      free (info);
       ptar_close (tar);
       return PTAR_EOPENFAIL;
     }
@@ -547,21 +946,29 @@ ptar_open (ptar_t *tar, const char *filename, const int mode)
     }
 
 
-  /* Map file memory */
+  /* Map file memory. Writers map it readable too, to find the end of it */
+  info->prot = (mode & PROT_WRITE) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+  info->file_size = st.st_size;
   info->data = mmap (
                      NULL,
                      len,
-                     mode,
+                     info->prot,
                      MAP_SHARED,
                      info->fd, 0);
   if (MAP_FAILED == info->data)
     {
       tar->stream = NULL;
-      PTrace(ERROR_LEVEL, "mmap failed with err : %d", err = errno);
+      /* Arguments of a dropped line are not evaluated */
+      err = errno;
+      PTraceRate(ERROR_LEVEL, 10, 20, "mmap failed with err : %d", err);
     }
   else
     {
-      info->size = st.st_size;
+      info->size = len;
+      info->base = info->data;
+      info->map_size = len;
+      info->own_fd = 1;
+      info->grow = (mode & PROT_WRITE) != 0;
       tar->stream = info;
       err = ptar_read_header (tar, &h);
       /* Read first header to check it is valid if mode is `r` */
@@ -572,6 +979,11 @@ ptar_open (ptar_t *tar, const char *filename, const int mode)
           return err;
         }
       ptar_rewind (tar);
+      /* Resume after the existing end-of-archive marker */
+      if ((mode & PTAR_APPEND) && PTAR_ESUCCESS != (err = ptar_seek_end (tar)))
+        {
+          return err;
+        }
     }
 
   /* Return ok */
@@ -579,6 +991,378 @@ ptar_open (ptar_t *tar, const char *filename, const int mode)
   return PTAR_ESUCCESS;
 }
 
+/*
+ * pread/pwrite backend for windows of descriptors that can not be mapped.
+ */
+struct pread_info
+{
+  int fd;
+  off_t offset;
+  unsigned size;
+  int own_fd;
+};
+
+static int
+pread_write (ptar_t *tar, const void *data, unsigned size)
+{
+  ssize_t n;
+  const unsigned char *p = data;
+  struct pread_info *info = tar->stream;
+  unsigned pos = tar->pos;
+  if (NULL == info || pos > info->size || size > info->size - pos)
+    {
+      return PTAR_EWRITEFAIL;
+    }
+  while (size > 0)
+    {
+      n = pwrite (info->fd, p, size, info->offset + pos);
+      if (n < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      if (n <= 0)
+        {
+          return PTAR_EWRITEFAIL;
+        }
+      p += n;
+      pos += n;
+      size -= n;
+    }
+  return PTAR_ESUCCESS;
+}
+
+static int
+pread_read (ptar_t *tar, void *data, unsigned size)
+{
+  ssize_t n;
+  unsigned char *p = data;
+  struct pread_info *info = tar->stream;
+  unsigned pos = tar->pos;
+  if (NULL == info || pos > info->size || size > info->size - pos)
+    {
+      return PTAR_EREADFAIL;
+    }
+  while (size > 0)
+    {
+      n = pread (info->fd, p, size, info->offset + pos);
+      if (n < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      if (n <= 0)
+        {
+          return PTAR_EREADFAIL;
+        }
+      p += n;
+      pos += n;
+      size -= n;
+    }
+  return PTAR_ESUCCESS;
+}
+
+static int
+pread_seek (ptar_t *tar, unsigned offset)
+{
+  struct pread_info *info = tar->stream;
+  if (NULL == info || offset > info->size)
+    {
+      return PTAR_ESEEKFAIL;
+    }
+  return PTAR_ESUCCESS;
+}
+
+static int
+pread_close (ptar_t *tar)
+{
+  struct pread_info *info = tar->stream;
+  if (NULL == info)
+    {
+      return PTAR_EFAILURE;
+    }
+  if (info->own_fd)
+    {
+      close (info->fd);
+    }
+  free (info);
+  tar->stream = NULL;
+  return PTAR_ESUCCESS;
+}
+
+/* Map [offset, offset + length) of fd. mmap needs a page aligned offset, so
+ * the mapping starts at the page holding offset and data points into it */
+static int
+map_window (struct mmap_info *info, int fd, off_t offset, unsigned length,
+            int prot)
+{
+  long page = sysconf (_SC_PAGESIZE);
+  off_t aligned = offset - offset % page;
+  size_t delta = offset - aligned;
+
+  info->map_size = delta + length;
+  info->base = mmap (NULL, info->map_size, prot, MAP_SHARED, fd, aligned);
+  if (MAP_FAILED == info->base)
+    {
+      info->base = NULL;
+      return PTAR_EOPENFAIL;
+    }
+  info->fd = fd;
+  info->offset = offset;
+  info->prot = prot;
+  info->data = info->base + delta;
+  info->size = length;
+  return PTAR_ESUCCESS;
+}
+
+static void
+punch_hole (ptar_t *tar, unsigned pos, unsigned len)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+  int fd = -1;
+  off_t offset = 0;
+  if (tar->close == file_close && NULL != ((struct mmap_info*) tar->stream)->base)
+    {
+      fd = ((struct mmap_info*) tar->stream)->fd;
+      offset = ((struct mmap_info*) tar->stream)->offset;
+    }
+  else if (tar->close == pread_close)
+    {
+      fd = ((struct pread_info*) tar->stream)->fd;
+      offset = ((struct pread_info*) tar->stream)->offset;
+    }
+  /* Memory backends have no blocks to give back */
+  if (fd == -1 || len == 0)
+    {
+      return;
+    }
+  if (0 != fallocate (fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      offset + pos, len))
+    {
+      PTrace(INFO_LEVEL, "Hole punching not supported on fd : %d, Error : %d", fd, errno);
+    }
+#endif
+}
+
+static void
+trim_end (ptar_t *tar, unsigned end)
+{
+  struct mmap_info *info = tar->stream;
+  /* Files owned by ptar_open are cut to the new end on close */
+  if (tar->close == file_close && info->grow)
+    {
+      info->file_size = end;
+      info->end = end;
+    }
+}
+
+int
+ptar_open_fd (ptar_t *tar, int fd, off_t offset, unsigned length, int flags)
+{
+  int err;
+  ptar_header_t h;
+  struct stat st;
+  struct mmap_info *minfo;
+  struct pread_info *pinfo;
+  int prot = flags & (PROT_READ | PROT_WRITE);
+
+  memset (tar, 0, sizeof(*tar));
+  if (offset < 0 || 0 != fstat (fd, &st))
+    {
+      return PTAR_EOPENFAIL;
+    }
+  /* Neither given: the window is read */
+  if (0 == prot)
+    {
+      prot = PROT_READ;
+    }
+  /* Length 0 takes everything up to the end of the file */
+  if (0 == length)
+    {
+      if (st.st_size <= offset)
+        {
+          PTrace(ERROR_LEVEL, "Empty window at offset %ld of fd : %d", (long) offset, fd);
+          return PTAR_EOPENFAIL;
+        }
+      length = st.st_size - offset;
+    }
+  /* A mapping faults when touched past the end of the file: there is
+   * nothing to read, and writers go through pwrite, which extends it */
+  else if (S_ISREG (st.st_mode) && offset + (off_t) length > st.st_size)
+    {
+      if (!(prot & PROT_WRITE))
+        {
+          PTrace(ERROR_LEVEL, "Window [%ld, +%u) is past the end of fd : %d", (long) offset, length, fd);
+          return PTAR_EOPENFAIL;
+        }
+      flags |= PTAR_FD_PREAD;
+    }
+
+  minfo = calloc (1, sizeof(struct mmap_info));
+  if (NULL == minfo)
+    {
+      return PTAR_EOPENFAIL;
+    }
+  if (!(flags & PTAR_FD_PREAD)
+      && PTAR_ESUCCESS == map_window (minfo, fd, offset, length, prot))
+    {
+      tar->write = file_write;
+      tar->read = file_read;
+      tar->seek = file_seek;
+      tar->close = file_close;
+      tar->stream = minfo;
+    }
+  else
+    {
+      /* Not mappable (or asked not to map): read the window with pread */
+      free (minfo);
+      pinfo = malloc (sizeof(struct pread_info));
+      if (NULL == pinfo)
+        {
+          return PTAR_EOPENFAIL;
+        }
+      pinfo->fd = fd;
+      pinfo->offset = offset;
+      pinfo->size = length;
+      pinfo->own_fd = 0;
+      tar->write = pread_write;
+      tar->read = pread_read;
+      tar->seek = pread_seek;
+      tar->close = pread_close;
+      tar->stream = pinfo;
+    }
+
+  /* Read first header to check the window holds an archive. The fd is only
+   * handed over once the open succeeded */
+  err = ptar_read_header (tar, &h);
+  if (err != PTAR_ESUCCESS && err != PTAR_ENULLRECORD)
+    {
+      ptar_close (tar);
+      return err;
+    }
+  if (flags & PTAR_FD_OWN)
+    {
+      if (tar->close == file_close)
+        {
+          ((struct mmap_info*) tar->stream)->own_fd = 1;
+        }
+      else
+        {
+          ((struct pread_info*) tar->stream)->own_fd = 1;
+        }
+    }
+  return ptar_rewind (tar);
+}
+
+int
+ptar_open_memory (ptar_t *tar, const void *buf, unsigned len)
+{
+  int err;
+  ptar_header_t h;
+  struct mmap_info *info;
+
+  /* Init tar struct and functions. The region is read exactly like a mapping */
+  memset (tar, 0, sizeof(*tar));
+  tar->write = file_write;
+  tar->read = file_read;
+  tar->seek = file_seek;
+  tar->close = file_close;
+
+  info = calloc (1, sizeof(struct mmap_info));
+  if (NULL == info)
+    {
+      return PTAR_EOPENFAIL;
+    }
+  info->fd = -1;
+  info->prot = PROT_READ;
+  info->data = (unsigned char*) buf;
+  info->size = len;
+  tar->stream = info;
+
+  /* Read first header to check it is valid */
+  err = ptar_read_header (tar, &h);
+  if (err != PTAR_ESUCCESS)
+    {
+      ptar_close (tar);
+      return err;
+    }
+  return ptar_rewind (tar);
+}
+
+int
+ptar_open_member (ptar_t *outer, const char *name, ptar_t *inner)
+{
+  int err;
+  ptar_header_t h;
+  unsigned start;
+  struct mmap_info *minfo;
+  struct pread_info *pinfo;
+
+  err = ptar_find (outer, name, NULL);
+  if (err == PTAR_ESUCCESS)
+    {
+      err = ptar_load_header (outer, &h);
+    }
+  if (err)
+    {
+      return err;
+    }
+  /* A compressed or sparse member can not be a window of the outer archive */
+  if (h.type == PTAR_TFRAMED || h.type == PTAR_TSPARSE)
+    {
+      return PTAR_ENOTSUP;
+    }
+  start = outer->pos + sizeof(ptar_raw_header_t);
+
+  /* The inner archive is a window of the outer backend, nothing is copied */
+  memset (inner, 0, sizeof(*inner));
+  if (outer->close == file_close)
+    {
+      minfo = calloc (1, sizeof(struct mmap_info));
+      if (NULL == minfo)
+        {
+          return PTAR_EOPENFAIL;
+        }
+      minfo->fd = -1;
+      minfo->prot = ((struct mmap_info*) outer->stream)->prot;
+      minfo->data = ((struct mmap_info*) outer->stream)->data + start;
+      minfo->size = h.size;
+      inner->write = file_write;
+      inner->read = file_read;
+      inner->seek = file_seek;
+      inner->close = file_close;
+      inner->stream = minfo;
+    }
+  else if (outer->close == pread_close)
+    {
+      pinfo = calloc (1, sizeof(struct pread_info));
+      if (NULL == pinfo)
+        {
+          return PTAR_EOPENFAIL;
+        }
+      pinfo->fd = ((struct pread_info*) outer->stream)->fd;
+      pinfo->offset = ((struct pread_info*) outer->stream)->offset + start;
+      pinfo->size = h.size;
+      inner->write = pread_write;
+      inner->read = pread_read;
+      inner->seek = pread_seek;
+      inner->close = pread_close;
+      inner->stream = pinfo;
+    }
+  else
+    {
+      PTrace(ERROR_LEVEL, "Backend of the outer archive can not open member : %s", name);
+      return PTAR_EOPENFAIL;
+    }
+
+  /* Member must itself be an archive */
+  err = ptar_read_header (inner, &h);
+  if (err != PTAR_ESUCCESS && err != PTAR_ENULLRECORD)
+    {
+      ptar_close (inner);
+      return err;
+    }
+  return ptar_rewind (inner);
+}
+
 int
 ptar_get (ptar_t *tar, const char* filename, const void **ptr)
 {
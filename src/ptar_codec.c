@@ -0,0 +1,921 @@
+/*
+ * ptar_codec.c
+ *  Module     : ptar
+ *  Description: Compression stage. Sits between the ptar API and another
+ *               opened backend, so .tar.gz and .tar.zst archives are read and
+ *               written directly. Writing compresses the byte stream as it
+ *               goes; reading decodes it front to back into a window.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ptar_private.h"
+#ifdef PTAR_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef PTAR_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef POSIX_SYSTEM
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+struct codec_pool;
+
+struct codec_info
+{
+  ptar_t *lower;
+  unsigned lower_start;
+  int codec;
+  int writing;
+  /* Reading: no more compressed input / no more decoded output */
+  int input_end;
+  int eof;
+  unsigned char *in;
+  /* Writing: compressed output. Reading: decoded bytes at win_start */
+  unsigned char *win;
+  unsigned win_start;
+  unsigned win_len;
+  /* Last header read, so ptar_next after ptar_read_data needs no restart */
+  unsigned char hdr[sizeof(ptar_raw_header_t)];
+  unsigned hdr_pos;
+  int hdr_valid;
+#ifdef PTAR_HAVE_ZLIB
+  z_stream z;
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  ZSTD_CStream *zc;
+  ZSTD_DStream *zd;
+  ZSTD_inBuffer zin;
+  ZSTD_outBuffer zout;
+#endif
+  /* Writing with a thread pool: the stream is cut into independent blocks */
+  struct codec_pool *pool;
+};
+
+/*
+ * Read up to max bytes from the lower backend. Backend reads are all or
+ * nothing, so at the end of the input the largest read that still succeeds
+ * is searched for.
+ */
+static unsigned
+lower_read (ptar_t *lower, unsigned char *buf, unsigned max)
+{
+  unsigned lo = 0, hi = max, mid;
+  if (PTAR_ESUCCESS == lower->read (lower, buf, max))
+    {
+      lower->pos += max;
+      return max;
+    }
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo + 1) / 2;
+      if (PTAR_ESUCCESS == lower->read (lower, buf, mid))
+        {
+          lo = mid;
+        }
+      else
+        {
+          hi = mid - 1;
+        }
+    }
+  if (lo && PTAR_ESUCCESS != lower->read (lower, buf, lo))
+    {
+      return 0;
+    }
+  lower->pos += lo;
+  return lo;
+}
+
+static int
+lower_write (ptar_t *lower, const unsigned char *buf, unsigned size)
+{
+  return size ? twrite (lower, buf, size) : PTAR_ESUCCESS;
+}
+
+/* Refill the compressed input buffer once it is drained */
+static const unsigned char *
+next_input (struct codec_info *info, unsigned *len)
+{
+  *len = info->input_end ? 0 : lower_read (info->lower, info->in, PTAR_CODEC_BUFSIZE);
+  if (*len == 0)
+    {
+      info->input_end = 1;
+    }
+  return info->in;
+}
+
+#ifdef PTAR_HAVE_ZLIB
+static int
+gzip_decode (struct codec_info *info)
+{
+  int ret;
+  unsigned len, n;
+  while (info->win_len < PTAR_CODEC_BUFSIZE)
+    {
+      if (info->z.avail_in == 0)
+        {
+          info->z.next_in = (Bytef*) next_input (info, &len);
+          info->z.avail_in = len;
+        }
+      info->z.next_out = info->win + info->win_len;
+      info->z.avail_out = PTAR_CODEC_BUFSIZE - info->win_len;
+      ret = inflate (&info->z, Z_NO_FLUSH);
+      info->win_len = PTAR_CODEC_BUFSIZE - info->z.avail_out;
+      if (ret == Z_STREAM_END)
+        {
+          /* Concatenated members (as written by parallel compressors) follow
+           * one another; anything else after a member is ignored. The next
+           * magic may straddle the end of the input buffer: its first byte
+           * is kept and the rest read after it */
+          while (info->z.avail_in < 2 && !info->input_end)
+            {
+              n = info->z.avail_in;
+              if (n)
+                {
+                  info->in[0] = info->z.next_in[0];
+                }
+              len = lower_read (info->lower, info->in + n, PTAR_CODEC_BUFSIZE - n);
+              if (len == 0)
+                {
+                  info->input_end = 1;
+                }
+              info->z.next_in = info->in;
+              info->z.avail_in = n + len;
+            }
+          if (info->z.avail_in < 2 || info->z.next_in[0] != 0x1f
+              || info->z.next_in[1] != 0x8b)
+            {
+              info->eof = 1;
+              return PTAR_ESUCCESS;
+            }
+          inflateReset (&info->z);
+        }
+      else if (ret == Z_BUF_ERROR && info->input_end)
+        {
+          /* Input ended in the middle of a member */
+          return PTAR_ECORRUPT;
+        }
+      else if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+          return PTAR_ECORRUPT;
+        }
+    }
+  return PTAR_ESUCCESS;
+}
+#endif
+
+#ifdef PTAR_HAVE_ZSTD
+static int
+zstd_decode (struct codec_info *info)
+{
+  size_t ret = 1;
+  unsigned len;
+  while (info->win_len < PTAR_CODEC_BUFSIZE)
+    {
+      if (info->zin.pos == info->zin.size)
+        {
+          info->zin.src = next_input (info, &len);
+          info->zin.size = len;
+          info->zin.pos = 0;
+          if (len == 0)
+            {
+              /* Input may only end between frames */
+              if (ret != 0 && info->win_len == 0)
+                {
+                  return PTAR_ECORRUPT;
+                }
+              info->eof = 1;
+              return PTAR_ESUCCESS;
+            }
+        }
+      info->zout.dst = info->win;
+      info->zout.size = PTAR_CODEC_BUFSIZE;
+      info->zout.pos = info->win_len;
+      ret = ZSTD_decompressStream (info->zd, &info->zout, &info->zin);
+      if (ZSTD_isError (ret))
+        {
+          PTrace(ERROR_LEVEL, "zstd decode failed : %s", ZSTD_getErrorName (ret));
+          return PTAR_ECORRUPT;
+        }
+      info->win_len = info->zout.pos;
+    }
+  return PTAR_ESUCCESS;
+}
+#endif
+
+/* Slide the window past the bytes decoded so far and decode the next ones */
+static int
+decode_more (struct codec_info *info)
+{
+  info->win_start += info->win_len;
+  info->win_len = 0;
+#ifdef PTAR_HAVE_ZLIB
+  if (info->codec == PTAR_CODEC_GZIP)
+    {
+      return gzip_decode (info);
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (info->codec == PTAR_CODEC_ZSTD)
+    {
+      return zstd_decode (info);
+    }
+#endif
+  return PTAR_ENOTSUP;
+}
+
+/* Decode again from the start of the stream */
+static int
+restart (struct codec_info *info)
+{
+  info->win_start = 0;
+  info->win_len = 0;
+  info->input_end = 0;
+  info->eof = 0;
+#ifdef PTAR_HAVE_ZLIB
+  if (info->codec == PTAR_CODEC_GZIP)
+    {
+      info->z.avail_in = 0;
+      inflateReset (&info->z);
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (info->codec == PTAR_CODEC_ZSTD)
+    {
+      info->zin.size = info->zin.pos = 0;
+      ZSTD_DCtx_reset (info->zd, ZSTD_reset_session_only);
+    }
+#endif
+  return ptar_seek (info->lower, info->lower_start);
+}
+
+static int
+codec_read (ptar_t *tar, void *data, unsigned size)
+{
+  int err;
+  unsigned n, pos = tar->pos;
+  unsigned char *p = data;
+  struct codec_info *info = tar->stream;
+
+  if (NULL == info || info->writing)
+    {
+      return PTAR_EREADFAIL;
+    }
+  if (info->hdr_valid && pos >= info->hdr_pos
+      && pos + size <= info->hdr_pos + sizeof(info->hdr))
+    {
+      memcpy (data, info->hdr + (pos - info->hdr_pos), size);
+      return PTAR_ESUCCESS;
+    }
+  /* Going back means decoding again from the start */
+  if (pos < info->win_start && (err = restart (info)))
+    {
+      return PTAR_EREADFAIL;
+    }
+  while (size > 0)
+    {
+      if (pos < info->win_start + info->win_len)
+        {
+          n = info->win_start + info->win_len - pos;
+          n = n < size ? n : size;
+          memcpy (p, info->win + (pos - info->win_start), n);
+          p += n;
+          pos += n;
+          size -= n;
+          continue;
+        }
+      if (info->eof)
+        {
+          return PTAR_EREADFAIL;
+        }
+      err = decode_more (info);
+      if (err)
+        {
+          return err;
+        }
+    }
+  /* Keep header sized reads at record boundaries around */
+  if (pos - tar->pos == sizeof(info->hdr) && tar->pos % sizeof(info->hdr) == 0)
+    {
+      memcpy (info->hdr, data, sizeof(info->hdr));
+      info->hdr_pos = tar->pos;
+      info->hdr_valid = 1;
+    }
+  return PTAR_ESUCCESS;
+}
+
+#ifdef POSIX_SYSTEM
+/*
+ * Parallel writer. Input is cut into PTAR_CODEC_BLOCK sized blocks, each
+ * compressed by a pool thread into a self-contained gzip member or zstd
+ * frame. Blocks are written to the lower backend in order, so the output is
+ * a plain concatenated stream any decompressor reads.
+ */
+enum
+{
+  SLOT_FILLING, SLOT_QUEUED, SLOT_DONE, SLOT_FAILED
+};
+
+struct codec_slot
+{
+  unsigned char *in;
+  unsigned char *out;
+  unsigned in_len;
+  size_t out_len;
+  int state;
+};
+
+struct codec_pool
+{
+  pthread_mutex_t lock;
+  pthread_cond_t queued;
+  pthread_cond_t done;
+  pthread_t *threads;
+  int nthreads;
+  int codec;
+  int stop;
+  size_t bound;
+  struct codec_slot *slot;
+  unsigned nslots;
+  /* Block numbers: being filled, next for a worker, next to write out */
+  unsigned long fill;
+  unsigned long next;
+  unsigned long flushed;
+};
+
+static size_t
+block_bound (int codec)
+{
+#ifdef PTAR_HAVE_ZLIB
+  if (codec == PTAR_CODEC_GZIP)
+    {
+      /* compressBound plus the gzip header and trailer */
+      return compressBound (PTAR_CODEC_BLOCK) + 18;
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (codec == PTAR_CODEC_ZSTD)
+    {
+      return ZSTD_compressBound (PTAR_CODEC_BLOCK);
+    }
+#endif
+  return 0;
+}
+
+static int
+block_compress (int codec, void *ctx, struct codec_slot *s, size_t bound)
+{
+  (void) ctx;
+#ifdef PTAR_HAVE_ZLIB
+  if (codec == PTAR_CODEC_GZIP)
+    {
+      int ret;
+      z_stream z;
+      memset (&z, 0, sizeof(z));
+      if (Z_OK != deflateInit2 (&z, PTAR_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                                Z_DEFAULT_STRATEGY))
+        {
+          return PTAR_EWRITEFAIL;
+        }
+      z.next_in = s->in;
+      z.avail_in = s->in_len;
+      z.next_out = s->out;
+      z.avail_out = bound;
+      ret = deflate (&z, Z_FINISH);
+      s->out_len = bound - z.avail_out;
+      deflateEnd (&z);
+      return ret == Z_STREAM_END ? PTAR_ESUCCESS : PTAR_EWRITEFAIL;
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (codec == PTAR_CODEC_ZSTD)
+    {
+      s->out_len = ZSTD_compressCCtx (ctx, s->out, bound, s->in, s->in_len,
+                                      PTAR_ZSTD_LEVEL);
+      return ZSTD_isError (s->out_len) ? PTAR_EWRITEFAIL : PTAR_ESUCCESS;
+    }
+#endif
+  return PTAR_EWRITEFAIL;
+}
+
+static void *
+pool_worker (void *arg)
+{
+  struct codec_pool *pool = arg;
+  struct codec_slot *s;
+  void *ctx = NULL;
+  int err;
+
+#ifdef PTAR_HAVE_ZSTD
+  if (pool->codec == PTAR_CODEC_ZSTD)
+    {
+      ctx = ZSTD_createCCtx ();
+    }
+#endif
+  pthread_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      while (!pool->stop && pool->next == pool->fill)
+        {
+          pthread_cond_wait (&pool->queued, &pool->lock);
+        }
+      if (pool->next == pool->fill)
+        {
+          break;
+        }
+      s = &pool->slot[pool->next++ % pool->nslots];
+      pthread_mutex_unlock (&pool->lock);
+      err = block_compress (pool->codec, ctx, s, pool->bound);
+      pthread_mutex_lock (&pool->lock);
+      s->state = err ? SLOT_FAILED : SLOT_DONE;
+      pthread_cond_broadcast (&pool->done);
+    }
+  pthread_mutex_unlock (&pool->lock);
+#ifdef PTAR_HAVE_ZSTD
+  ZSTD_freeCCtx (ctx);
+#endif
+  return NULL;
+}
+
+/* Write out compressed blocks in order, waiting for them while fewer than
+ * `keep` blocks are queued after them */
+static int
+pool_drain (struct codec_info *info, unsigned keep)
+{
+  int err = PTAR_ESUCCESS;
+  struct codec_pool *pool = info->pool;
+  struct codec_slot *s;
+
+  pthread_mutex_lock (&pool->lock);
+  while (err == PTAR_ESUCCESS && pool->flushed < pool->fill)
+    {
+      s = &pool->slot[pool->flushed % pool->nslots];
+      if (s->state == SLOT_QUEUED)
+        {
+          if (pool->fill - pool->flushed <= keep)
+            {
+              break;
+            }
+          pthread_cond_wait (&pool->done, &pool->lock);
+          continue;
+        }
+      pthread_mutex_unlock (&pool->lock);
+      err = s->state == SLOT_DONE ? lower_write (info->lower, s->out, s->out_len)
+          : PTAR_EWRITEFAIL;
+      pthread_mutex_lock (&pool->lock);
+      s->state = SLOT_FILLING;
+      s->in_len = 0;
+      pool->flushed++;
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return err;
+}
+
+/* Hand the block being filled to the workers */
+static int
+pool_queue (struct codec_info *info)
+{
+  struct codec_pool *pool = info->pool;
+  pthread_mutex_lock (&pool->lock);
+  pool->slot[pool->fill % pool->nslots].state = SLOT_QUEUED;
+  pool->fill++;
+  pthread_cond_signal (&pool->queued);
+  pthread_mutex_unlock (&pool->lock);
+  /* Finished blocks go out as soon as possible, and a slot must be free */
+  return pool_drain (info, pool->nslots - 1);
+}
+
+static int
+pool_write (struct codec_info *info, const void *data, unsigned size)
+{
+  int err;
+  unsigned n;
+  struct codec_pool *pool = info->pool;
+  struct codec_slot *s;
+  const unsigned char *p = data;
+
+  while (size > 0)
+    {
+      /* Slot is free: pool_drain keeps the one at `fill` written out */
+      s = &pool->slot[pool->fill % pool->nslots];
+      n = PTAR_CODEC_BLOCK - s->in_len < size ? PTAR_CODEC_BLOCK - s->in_len : size;
+      memcpy (s->in + s->in_len, p, n);
+      s->in_len += n;
+      p += n;
+      size -= n;
+      if (s->in_len == PTAR_CODEC_BLOCK && (err = pool_queue (info)))
+        {
+          return err;
+        }
+    }
+  return PTAR_ESUCCESS;
+}
+
+static int
+pool_finish (struct codec_info *info)
+{
+  int err;
+  struct codec_pool *pool = info->pool;
+  /* An empty stream still gets one (empty) member */
+  if (pool->slot[pool->fill % pool->nslots].in_len || pool->fill == 0)
+    {
+      err = pool_queue (info);
+      if (err)
+        {
+          return err;
+        }
+    }
+  return pool_drain (info, 0);
+}
+
+static void
+pool_free (struct codec_pool *pool)
+{
+  unsigned i;
+  int t;
+  pthread_mutex_lock (&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast (&pool->queued);
+  pthread_mutex_unlock (&pool->lock);
+  for (t = 0; t < pool->nthreads; t++)
+    {
+      pthread_join (pool->threads[t], NULL);
+    }
+  for (i = 0; pool->slot && i < pool->nslots; i++)
+    {
+      free (pool->slot[i].in);
+      free (pool->slot[i].out);
+    }
+  pthread_mutex_destroy (&pool->lock);
+  pthread_cond_destroy (&pool->queued);
+  pthread_cond_destroy (&pool->done);
+  free (pool->slot);
+  free (pool->threads);
+  free (pool);
+}
+
+static int
+pool_init (struct codec_info *info, int threads)
+{
+  unsigned i;
+  struct codec_pool *pool;
+
+  if (threads <= 0)
+    {
+      threads = sysconf (_SC_NPROCESSORS_ONLN);
+      threads = threads > 0 ? threads : 1;
+    }
+  pool = calloc (1, sizeof(struct codec_pool));
+  if (NULL == pool)
+    {
+      return PTAR_EOPENFAIL;
+    }
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->queued, NULL);
+  pthread_cond_init (&pool->done, NULL);
+  pool->codec = info->codec;
+  pool->bound = block_bound (info->codec);
+  /* Two blocks per thread keep workers busy while the writer fills */
+  pool->nslots = 2 * threads;
+  pool->slot = calloc (pool->nslots, sizeof(struct codec_slot));
+  pool->threads = calloc (threads, sizeof(pthread_t));
+  info->pool = pool;
+  if (NULL == pool->slot || NULL == pool->threads)
+    {
+      return PTAR_EOPENFAIL;
+    }
+  for (i = 0; i < pool->nslots; i++)
+    {
+      pool->slot[i].in = malloc (PTAR_CODEC_BLOCK);
+      pool->slot[i].out = malloc (pool->bound);
+      if (NULL == pool->slot[i].in || NULL == pool->slot[i].out)
+        {
+          return PTAR_EOPENFAIL;
+        }
+    }
+  for (; pool->nthreads < threads; pool->nthreads++)
+    {
+      if (pthread_create (&pool->threads[pool->nthreads], NULL, pool_worker, pool))
+        {
+          PTrace(ERROR_LEVEL, "Failed to start compression thread %d", pool->nthreads);
+          break;
+        }
+    }
+  return pool->nthreads ? PTAR_ESUCCESS : PTAR_EOPENFAIL;
+}
+#endif
+
+static int
+codec_write (ptar_t *tar, const void *data, unsigned size)
+{
+  struct codec_info *info = tar->stream;
+  if (NULL == info || !info->writing || tar->pos != info->win_start)
+    {
+      return PTAR_EWRITEFAIL;
+    }
+  info->win_start += size;
+#ifdef POSIX_SYSTEM
+  if (info->pool)
+    {
+      return pool_write (info, data, size);
+    }
+#endif
+#ifdef PTAR_HAVE_ZLIB
+  if (info->codec == PTAR_CODEC_GZIP)
+    {
+      info->z.next_in = (Bytef*) data;
+      info->z.avail_in = size;
+      while (info->z.avail_in > 0)
+        {
+          if (Z_STREAM_ERROR == deflate (&info->z, Z_NO_FLUSH))
+            {
+              return PTAR_EWRITEFAIL;
+            }
+          if (info->z.avail_out == 0)
+            {
+              if (lower_write (info->lower, info->win, PTAR_CODEC_BUFSIZE))
+                {
+                  return PTAR_EWRITEFAIL;
+                }
+              info->z.next_out = info->win;
+              info->z.avail_out = PTAR_CODEC_BUFSIZE;
+            }
+        }
+      return PTAR_ESUCCESS;
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (info->codec == PTAR_CODEC_ZSTD)
+    {
+      ZSTD_inBuffer in = { data, size, 0 };
+      while (in.pos < in.size)
+        {
+          size_t ret = ZSTD_compressStream2 (info->zc, &info->zout, &in,
+                                             ZSTD_e_continue);
+          if (ZSTD_isError (ret))
+            {
+              return PTAR_EWRITEFAIL;
+            }
+          if (info->zout.pos == info->zout.size)
+            {
+              if (lower_write (info->lower, info->win, info->zout.pos))
+                {
+                  return PTAR_EWRITEFAIL;
+                }
+              info->zout.pos = 0;
+            }
+        }
+      return PTAR_ESUCCESS;
+    }
+#endif
+  return PTAR_EWRITEFAIL;
+}
+
+/* Writing: flush the end of the compressed stream to the lower backend */
+static int
+codec_finish (struct codec_info *info)
+{
+#ifdef POSIX_SYSTEM
+  if (info->pool)
+    {
+      return pool_finish (info);
+    }
+#endif
+#ifdef PTAR_HAVE_ZLIB
+  if (info->codec == PTAR_CODEC_GZIP)
+    {
+      int ret;
+      do
+        {
+          ret = deflate (&info->z, Z_FINISH);
+          if (ret == Z_STREAM_ERROR
+              || lower_write (info->lower, info->win,
+                              PTAR_CODEC_BUFSIZE - info->z.avail_out))
+            {
+              return PTAR_EWRITEFAIL;
+            }
+          info->z.next_out = info->win;
+          info->z.avail_out = PTAR_CODEC_BUFSIZE;
+        }
+      while (ret != Z_STREAM_END);
+      return PTAR_ESUCCESS;
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (info->codec == PTAR_CODEC_ZSTD)
+    {
+      size_t ret;
+      ZSTD_inBuffer in = { NULL, 0, 0 };
+      do
+        {
+          ret = ZSTD_compressStream2 (info->zc, &info->zout, &in, ZSTD_e_end);
+          if (ZSTD_isError (ret)
+              || lower_write (info->lower, info->win, info->zout.pos))
+            {
+              return PTAR_EWRITEFAIL;
+            }
+          info->zout.pos = 0;
+        }
+      while (ret != 0);
+      return PTAR_ESUCCESS;
+    }
+#endif
+  return PTAR_EWRITEFAIL;
+}
+
+static int
+codec_seek (ptar_t *tar, unsigned offset)
+{
+  struct codec_info *info = tar->stream;
+  if (NULL == info)
+    {
+      return PTAR_ESEEKFAIL;
+    }
+  /* Readers can go anywhere (backwards costs a restart), writers nowhere */
+  if (info->writing && offset != tar->pos)
+    {
+      return PTAR_ESEEKFAIL;
+    }
+  return PTAR_ESUCCESS;
+}
+
+/* Release codec state. Does not touch the lower backend */
+static void
+codec_free (struct codec_info *info)
+{
+#ifdef POSIX_SYSTEM
+  if (info->pool)
+    {
+      pool_free (info->pool);
+    }
+#endif
+#ifdef PTAR_HAVE_ZLIB
+  if (info->codec == PTAR_CODEC_GZIP && info->z.state)
+    {
+      if (info->writing)
+        {
+          deflateEnd (&info->z);
+        }
+      else
+        {
+          inflateEnd (&info->z);
+        }
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  ZSTD_freeCStream (info->zc);
+  ZSTD_freeDStream (info->zd);
+#endif
+  free (info->in);
+  free (info->win);
+  free (info);
+}
+
+static int
+codec_close (ptar_t *tar)
+{
+  int err = PTAR_ESUCCESS;
+  struct codec_info *info = tar->stream;
+  if (NULL == info)
+    {
+      return PTAR_EFAILURE;
+    }
+  if (info->writing)
+    {
+      err = codec_finish (info);
+    }
+  codec_free (info);
+  tar->stream = NULL;
+  return err;
+}
+
+static int
+codec_init (struct codec_info *info)
+{
+#ifdef PTAR_HAVE_ZLIB
+  if (info->codec == PTAR_CODEC_GZIP)
+    {
+      int ret;
+      /* windowBits + 16 selects the gzip wrapper */
+      if (info->writing)
+        {
+          ret = deflateInit2 (&info->z, PTAR_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                              Z_DEFAULT_STRATEGY);
+          info->z.next_out = info->win;
+          info->z.avail_out = PTAR_CODEC_BUFSIZE;
+        }
+      else
+        {
+          ret = inflateInit2 (&info->z, 15 + 16);
+        }
+      return ret == Z_OK ? PTAR_ESUCCESS : PTAR_EOPENFAIL;
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (info->codec == PTAR_CODEC_ZSTD)
+    {
+      if (info->writing)
+        {
+          info->zc = ZSTD_createCStream ();
+          if (NULL == info->zc)
+            {
+              return PTAR_EOPENFAIL;
+            }
+          ZSTD_CCtx_setParameter (info->zc, ZSTD_c_compressionLevel,
+                                  PTAR_ZSTD_LEVEL);
+          info->zout.dst = info->win;
+          info->zout.size = PTAR_CODEC_BUFSIZE;
+          info->zout.pos = 0;
+        }
+      else
+        {
+          info->zd = ZSTD_createDStream ();
+          if (NULL == info->zd)
+            {
+              return PTAR_EOPENFAIL;
+            }
+        }
+      return PTAR_ESUCCESS;
+    }
+#endif
+  return PTAR_ENOTSUP;
+}
+
+static int
+codec_open (ptar_t *tar, ptar_t *lower, int codec, int mode, int threads)
+{
+  int err;
+  struct codec_info *info;
+
+  /* Init tar struct and functions */
+  memset (tar, 0, sizeof(*tar));
+  tar->write = codec_write;
+  tar->read = codec_read;
+  tar->seek = codec_seek;
+  tar->close = codec_close;
+  tar->no_readback = 1;
+
+  info = calloc (1, sizeof(struct codec_info));
+  if (NULL == info)
+    {
+      return PTAR_EOPENFAIL;
+    }
+  info->lower = lower;
+  info->lower_start = lower->pos;
+  info->codec = codec;
+  info->writing = (mode & PROT_WRITE) != 0;
+  info->in = malloc (PTAR_CODEC_BUFSIZE);
+  info->win = malloc (PTAR_CODEC_BUFSIZE);
+  if (NULL == info->in || NULL == info->win)
+    {
+      codec_free (info);
+      return PTAR_EOPENFAIL;
+    }
+  err = threads < 0 ? codec_init (info) : PTAR_ENOTSUP;
+#ifdef POSIX_SYSTEM
+  if (threads >= 0 && block_bound (codec))
+    {
+      err = pool_init (info, threads);
+    }
+#endif
+  if (err)
+    {
+      if (err == PTAR_ENOTSUP)
+        {
+          PTrace(ERROR_LEVEL, "Compression codec %d is not available", codec);
+        }
+      codec_free (info);
+      return err;
+    }
+  tar->stream = info;
+  return PTAR_ESUCCESS;
+}
+
+int
+ptar_open_compressed (ptar_t *tar, ptar_t *lower, int codec, int mode)
+{
+  return codec_open (tar, lower, codec, mode, -1);
+}
+
+int
+ptar_open_compressed_mt (ptar_t *tar, ptar_t *lower, int codec, int threads)
+{
+  return codec_open (tar, lower, codec, PROT_WRITE, threads < 0 ? 0 : threads);
+}
@@ -0,0 +1,200 @@
+/*
+ * ptar_dedup.c
+ *  Module     : ptar
+ *  Description: Deduplicating writer. Payloads written with ptar_write_file
+ *               are hashed; a payload equal to one already in the archive is
+ *               stored as a hard link (PTAR_TLNK) to the first copy.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ptar_private.h"
+
+#define DEDUP_MIN_SLOTS 256
+/* Size of the chunks a candidate is read back in to be compared */
+#define DEDUP_CMP_CHUNK (64 * 1024)
+
+struct dedup_entry
+{
+  uint64_t hash;
+  unsigned size;
+  unsigned data_pos;
+  char *name;
+};
+
+struct ptar_dedup
+{
+  struct dedup_entry *slot;
+  unsigned nslots;
+  unsigned count;
+};
+
+void
+ptar_dedup_free (struct ptar_dedup *dedup)
+{
+  unsigned i;
+  if (NULL == dedup)
+    {
+      return;
+    }
+  for (i = 0; i < dedup->nslots; i++)
+    {
+      free (dedup->slot[i].name);
+    }
+  free (dedup->slot);
+  free (dedup);
+}
+
+int
+ptar_set_dedup (ptar_t *tar, int enable)
+{
+  if (!enable)
+    {
+      ptar_dedup_free (tar->dedup);
+      tar->dedup = NULL;
+    }
+  else if (NULL == tar->dedup)
+    {
+      tar->dedup = calloc (1, sizeof(struct ptar_dedup));
+      if (NULL == tar->dedup)
+        {
+          return PTAR_EFAILURE;
+        }
+    }
+  return PTAR_ESUCCESS;
+}
+
+/* Open addressing: keep the table at most 3/4 full */
+static int
+dedup_insert (struct ptar_dedup *dedup, const struct dedup_entry *e)
+{
+  unsigned i, n;
+  struct dedup_entry *old = dedup->slot;
+  unsigned nold = dedup->nslots;
+
+  if (4 * (dedup->count + 1) > 3 * dedup->nslots)
+    {
+      n = nold ? 2 * nold : DEDUP_MIN_SLOTS;
+      dedup->slot = calloc (n, sizeof(struct dedup_entry));
+      if (NULL == dedup->slot)
+        {
+          dedup->slot = old;
+          return PTAR_EFAILURE;
+        }
+      dedup->nslots = n;
+      dedup->count = 0;
+      for (i = 0; i < nold; i++)
+        {
+          if (old[i].name)
+            {
+              dedup_insert (dedup, &old[i]);
+            }
+        }
+      free (old);
+    }
+  for (i = e->hash & (dedup->nslots - 1); dedup->slot[i].name;
+      i = (i + 1) & (dedup->nslots - 1))
+    ;
+  dedup->slot[i] = *e;
+  dedup->count++;
+  return PTAR_ESUCCESS;
+}
+
+/* Compare data with the payload stored at data_pos */
+static int
+dedup_same (ptar_t *tar, unsigned data_pos, const unsigned char *data,
+            unsigned size)
+{
+  int same = 1;
+  unsigned n, pos = tar->pos;
+  unsigned char *buf = malloc (size < DEDUP_CMP_CHUNK ? size : DEDUP_CMP_CHUNK);
+
+  if (NULL == buf || ptar_seek (tar, data_pos))
+    {
+      same = 0;
+    }
+  while (same && size > 0)
+    {
+      n = size < DEDUP_CMP_CHUNK ? size : DEDUP_CMP_CHUNK;
+      same = tread (tar, buf, n) == PTAR_ESUCCESS && !memcmp (buf, data, n);
+      data += n;
+      size -= n;
+    }
+  free (buf);
+  if (ptar_seek (tar, pos))
+    {
+      return -1;
+    }
+  return same;
+}
+
+int
+ptar_write_file (ptar_t *tar, const char *name, const void *data,
+                 unsigned size)
+{
+  int err, same;
+  unsigned i;
+  ptar_header_t h;
+  struct dedup_entry e;
+  /* Backends that can not read back the earlier copy get full copies */
+  struct ptar_dedup *dedup = tar->no_readback ? NULL : tar->dedup;
+
+  if (dedup && size > 0)
+    {
+      e.hash = ptar_hash64 (data, size);
+      for (i = dedup->nslots ? e.hash & (dedup->nslots - 1) : 0;
+          dedup->nslots && dedup->slot[i].name; i = (i + 1) & (dedup->nslots - 1))
+        {
+          if (dedup->slot[i].hash != e.hash || dedup->slot[i].size != size)
+            {
+              continue;
+            }
+          same = dedup_same (tar, dedup->slot[i].data_pos, data, size);
+          if (same < 0)
+            {
+              return PTAR_ESEEKFAIL;
+            }
+          if (same)
+            {
+              memset (&h, 0, sizeof(h));
+              strcpy (h.name, name);
+              strcpy (h.linkname, dedup->slot[i].name);
+              h.type = PTAR_TLNK;
+              h.mode = 0664;
+              return ptar_write_header (tar, &h);
+            }
+        }
+      e.size = size;
+      e.data_pos = tar->pos + sizeof(ptar_raw_header_t);
+    }
+  err = ptar_write_file_header (tar, name, size);
+  if (err == PTAR_ESUCCESS && size > 0)
+    {
+      err = ptar_write_data (tar, data, size);
+    }
+  /* First copy: remember where it is. Failing to is not an error */
+  if (err == PTAR_ESUCCESS && dedup && size > 0)
+    {
+      e.name = strdup (name);
+      if (e.name && dedup_insert (dedup, &e))
+        {
+          free (e.name);
+        }
+    }
+  return err;
+}
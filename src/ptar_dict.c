@@ -0,0 +1,488 @@
+/*
+ * ptar_dict.c
+ *  Module     : ptar
+ *  Description: Shared compression dictionaries. A dictionary is trained on
+ *               sample members and stored in the archive as a PTAR_TDICT
+ *               entry; framed members name it by id in their trailer, so each
+ *               member still decodes on its own.
+ *
+ *               Payload layout, integers little endian:
+ *                 "PTARDIC1", codec, id, dictionary bytes
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ptar_private.h"
+#ifdef PTAR_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef PTAR_HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#define DICT_MAGIC      "PTARDIC1"
+#define DICTS_MIN       8
+#define DICT_PREFIX     16
+#define DICT_NAME       ".ptar.dict"
+/* Largest window a zlib preset dictionary can use */
+#define ZLIB_DICT_MAX   (32 * 1024)
+
+/* Where the dictionary entries of the archive are. Headers are scanned once,
+ * up to `end`; members written later are scanned from there */
+struct ptar_dicts
+{
+  struct
+  {
+    unsigned id;
+    /* Header offset + 1 */
+    unsigned pos;
+  } *entry;
+  unsigned count;
+  unsigned capacity;
+  unsigned end;
+};
+
+static void
+put32 (unsigned char *p, unsigned v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static unsigned
+get32 (const unsigned char *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (unsigned) p[3] << 24;
+}
+
+void
+ptar_dict_free (struct ptar_dict *dict)
+{
+  if (NULL == dict)
+    {
+      return;
+    }
+#ifdef PTAR_HAVE_ZSTD
+  ZSTD_freeCDict (dict->cdict);
+  ZSTD_freeDDict (dict->ddict);
+  ZSTD_freeCCtx (dict->cctx);
+  ZSTD_freeDCtx (dict->dctx);
+#endif
+  free (dict->data);
+  free (dict);
+}
+
+/* Build the dictionary bytes from the samples. Returns their length, 0 if
+ * no dictionary could be built */
+static unsigned
+dict_train (int codec, unsigned char *dict, unsigned capacity,
+            const void *const *samples, const unsigned *sizes, unsigned count)
+{
+  unsigned i, n, len = 0;
+#ifdef PTAR_HAVE_ZSTD
+  if (codec == PTAR_CODEC_ZSTD)
+    {
+      size_t ret, total = 0, *lens;
+      unsigned char *all;
+      for (i = 0; i < count; i++)
+        {
+          total += sizes[i];
+        }
+      all = malloc (total ? total : 1);
+      lens = malloc (count * sizeof(size_t));
+      if (all && lens)
+        {
+          for (i = 0, total = 0; i < count; i++)
+            {
+              memcpy (all + total, samples[i], sizes[i]);
+              total += sizes[i];
+              lens[i] = sizes[i];
+            }
+          ret = ZDICT_trainFromBuffer (dict, capacity, all, lens, count);
+          if (ZDICT_isError (ret))
+            {
+              PTrace(ERROR_LEVEL, "Dictionary training failed : %s",
+                     ZDICT_getErrorName (ret));
+            }
+          else
+            {
+              len = ret;
+            }
+        }
+      free (all);
+      free (lens);
+      return len;
+    }
+#endif
+  (void) codec;
+  /* Preset dictionary: strings near its end are the cheapest to refer to,
+   * so it ends with the first samples */
+  if (capacity > ZLIB_DICT_MAX)
+    {
+      capacity = ZLIB_DICT_MAX;
+    }
+  for (i = 0; i < count && len < capacity; i++)
+    {
+      n = sizes[i] < capacity - len ? sizes[i] : capacity - len;
+      memcpy (dict + capacity - len - n, samples[i], n);
+      len += n;
+    }
+  memmove (dict, dict + capacity - len, len);
+  return len;
+}
+
+int
+ptar_write_dict (ptar_t *tar, int codec, const void *const *samples,
+                 const unsigned *sizes, unsigned count, unsigned capacity)
+{
+  int err;
+  ptar_header_t h;
+  struct ptar_dict *dict;
+  unsigned char prefix[DICT_PREFIX];
+
+  switch (codec)
+    {
+#ifdef PTAR_HAVE_ZLIB
+    case PTAR_CODEC_ZLIB:
+#endif
+#ifdef PTAR_HAVE_ZSTD
+    case PTAR_CODEC_ZSTD:
+#endif
+      break;
+    default:
+      return PTAR_ENOTSUP;
+    }
+  if (capacity == 0)
+    {
+      capacity = PTAR_DICT_SIZE;
+    }
+  dict = calloc (1, sizeof(struct ptar_dict));
+  if (NULL == dict || NULL == (dict->data = malloc (capacity)))
+    {
+      ptar_dict_free (dict);
+      return PTAR_EFAILURE;
+    }
+  dict->codec = codec;
+  dict->size = dict_train (codec, dict->data, capacity, samples, sizes, count);
+  if (dict->size == 0)
+    {
+      ptar_dict_free (dict);
+      return PTAR_EFAILURE;
+    }
+#ifdef PTAR_HAVE_ZSTD
+  if (codec == PTAR_CODEC_ZSTD)
+    {
+      dict->id = ZDICT_getDictID (dict->data, dict->size);
+    }
+#endif
+#ifdef PTAR_HAVE_ZLIB
+  if (codec == PTAR_CODEC_ZLIB)
+    {
+      dict->id = adler32 (adler32 (0, NULL, 0), dict->data, dict->size);
+    }
+#endif
+  /* 0 means "no dictionary" in frame trailers */
+  dict->id = dict->id ? dict->id : 1;
+
+  memset (&h, 0, sizeof(h));
+  strcpy (h.name, DICT_NAME);
+  h.size = DICT_PREFIX + dict->size;
+  h.type = PTAR_TDICT;
+  h.mode = 0644;
+  memcpy (prefix, DICT_MAGIC, 8);
+  put32 (prefix + 8, codec);
+  put32 (prefix + 12, dict->id);
+  err = ptar_write_header (tar, &h);
+  if (err == PTAR_ESUCCESS)
+    {
+      err = ptar_write_data (tar, prefix, DICT_PREFIX);
+    }
+  if (err == PTAR_ESUCCESS)
+    {
+      err = ptar_write_data (tar, dict->data, dict->size);
+    }
+  if (err)
+    {
+      ptar_dict_free (dict);
+      return err;
+    }
+  ptar_dict_free (tar->dict);
+  tar->dict = dict;
+  return PTAR_ESUCCESS;
+}
+
+/* Load the dictionary entry at the current position if it has the given id */
+static struct ptar_dict *
+dict_load (ptar_t *tar, unsigned stored, unsigned id)
+{
+  unsigned char prefix[DICT_PREFIX];
+  struct ptar_dict *dict;
+  if (stored < DICT_PREFIX
+      || ptar_seek (tar, tar->pos + sizeof(ptar_raw_header_t))
+      || tread (tar, prefix, DICT_PREFIX)
+      || memcmp (prefix, DICT_MAGIC, 8) || get32 (prefix + 12) != id)
+    {
+      return NULL;
+    }
+  dict = calloc (1, sizeof(struct ptar_dict));
+  if (NULL == dict || NULL == (dict->data = malloc (stored - DICT_PREFIX)))
+    {
+      ptar_dict_free (dict);
+      return NULL;
+    }
+  dict->codec = get32 (prefix + 8);
+  dict->id = id;
+  dict->size = stored - DICT_PREFIX;
+  if (tread (tar, dict->data, dict->size))
+    {
+      ptar_dict_free (dict);
+      return NULL;
+    }
+  return dict;
+}
+
+void
+ptar_dicts_free (struct ptar_dicts *dicts)
+{
+  if (dicts)
+    {
+      free (dicts->entry);
+      free (dicts);
+    }
+}
+
+/* Header offset + 1 of dictionary id, 0 if it is not known */
+static unsigned
+dicts_lookup (const struct ptar_dicts *dicts, unsigned id)
+{
+  unsigned i;
+  for (i = 0; i < dicts->count; i++)
+    {
+      if (dicts->entry[i].id == id)
+        {
+          return dicts->entry[i].pos;
+        }
+    }
+  return 0;
+}
+
+/* Record the dictionary entries from dicts->end up to the end of the
+ * archive */
+static void
+dicts_scan (ptar_t *tar, struct ptar_dicts *dicts)
+{
+  int err;
+  ptar_header_t h;
+  unsigned pos, n;
+  void *p;
+  unsigned char prefix[DICT_PREFIX];
+
+  tar->remaining_data = 0;
+  err = ptar_seek (tar, dicts->end);
+  while (err == PTAR_ESUCCESS
+      && (err = ptar_load_header (tar, &h)) == PTAR_ESUCCESS)
+    {
+      pos = tar->pos;
+      if (h.type == PTAR_TDICT && h.size >= DICT_PREFIX
+          && PTAR_ESUCCESS == ptar_seek (tar, pos + sizeof(ptar_raw_header_t))
+          && PTAR_ESUCCESS == tread (tar, prefix, DICT_PREFIX)
+          && !memcmp (prefix, DICT_MAGIC, 8))
+        {
+          if (dicts->count == dicts->capacity)
+            {
+              n = dicts->capacity ? 2 * dicts->capacity : DICTS_MIN;
+              p = realloc (dicts->entry, n * sizeof(*dicts->entry));
+              if (NULL == p)
+                {
+                  break;
+                }
+              dicts->entry = p;
+              dicts->capacity = n;
+            }
+          dicts->entry[dicts->count].id = get32 (prefix + 12);
+          dicts->entry[dicts->count++].pos = pos + 1;
+        }
+      err = ptar_seek (tar, pos);
+      if (err == PTAR_ESUCCESS)
+        {
+          err = ptar_next (tar);
+        }
+      if (err == PTAR_ESUCCESS)
+        {
+          dicts->end = tar->pos;
+        }
+    }
+}
+
+struct ptar_dict *
+ptar_dict_find (ptar_t *tar, unsigned id)
+{
+  ptar_header_t h;
+  unsigned remaining = tar->remaining_data;
+  unsigned pos;
+  struct ptar_dict *dict = NULL;
+
+  if (tar->dict && tar->dict->id == id)
+    {
+      return tar->dict;
+    }
+  if (tar->dict_cache && tar->dict_cache->id == id)
+    {
+      return tar->dict_cache;
+    }
+  if (NULL == tar->dicts)
+    {
+      tar->dicts = calloc (1, sizeof(struct ptar_dicts));
+    }
+  if (tar->dicts)
+    {
+      pos = dicts_lookup (tar->dicts, id);
+      if (0 == pos)
+        {
+          /* Only members written since the last scan are read */
+          dicts_scan (tar, tar->dicts);
+          pos = dicts_lookup (tar->dicts, id);
+        }
+      if (pos && PTAR_ESUCCESS == ptar_seek (tar, pos - 1)
+          && PTAR_ESUCCESS == ptar_load_header (tar, &h)
+          && h.type == PTAR_TDICT)
+        {
+          dict = dict_load (tar, h.size, id);
+        }
+    }
+  tar->remaining_data = remaining;
+  if (dict)
+    {
+      ptar_dict_free (tar->dict_cache);
+      tar->dict_cache = dict;
+    }
+  else
+    {
+      PTrace(ERROR_LEVEL, "Dictionary %u is not in the archive", id);
+    }
+  return dict;
+}
+
+unsigned
+ptar_dict_encode (struct ptar_dict *dict, unsigned char *out, unsigned cap,
+                  const unsigned char *in, unsigned size)
+{
+#ifdef PTAR_HAVE_ZLIB
+  if (dict->codec == PTAR_CODEC_ZLIB)
+    {
+      unsigned len = 0;
+      z_stream z;
+      memset (&z, 0, sizeof(z));
+      if (Z_OK != deflateInit (&z, Z_DEFAULT_COMPRESSION))
+        {
+          return 0;
+        }
+      if (Z_OK == deflateSetDictionary (&z, dict->data, dict->size))
+        {
+          z.next_in = (Bytef*) in;
+          z.avail_in = size;
+          z.next_out = out;
+          z.avail_out = cap;
+          if (Z_STREAM_END == deflate (&z, Z_FINISH))
+            {
+              len = z.total_out;
+            }
+        }
+      deflateEnd (&z);
+      return len;
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (dict->codec == PTAR_CODEC_ZSTD)
+    {
+      size_t len;
+      if (NULL == dict->cdict)
+        {
+          dict->cdict = ZSTD_createCDict (dict->data, dict->size, PTAR_ZSTD_LEVEL);
+          dict->cctx = ZSTD_createCCtx ();
+        }
+      if (NULL == dict->cdict || NULL == dict->cctx)
+        {
+          return 0;
+        }
+      len = ZSTD_compress_usingCDict (dict->cctx, out, cap, in, size, dict->cdict);
+      return ZSTD_isError (len) ? 0 : len;
+    }
+#endif
+  (void) out;
+  (void) cap;
+  (void) in;
+  (void) size;
+  return 0;
+}
+
+int
+ptar_dict_decode (struct ptar_dict *dict, unsigned char *out, unsigned size,
+                  const unsigned char *in, unsigned len)
+{
+#ifdef PTAR_HAVE_ZLIB
+  if (dict->codec == PTAR_CODEC_ZLIB)
+    {
+      int ret;
+      z_stream z;
+      memset (&z, 0, sizeof(z));
+      if (Z_OK != inflateInit (&z))
+        {
+          return PTAR_EFAILURE;
+        }
+      z.next_in = (Bytef*) in;
+      z.avail_in = len;
+      z.next_out = out;
+      z.avail_out = size;
+      ret = inflate (&z, Z_FINISH);
+      if (ret == Z_NEED_DICT
+          && Z_OK == inflateSetDictionary (&z, dict->data, dict->size))
+        {
+          ret = inflate (&z, Z_FINISH);
+        }
+      inflateEnd (&z);
+      return ret == Z_STREAM_END && z.total_out == size ? PTAR_ESUCCESS
+          : PTAR_ECORRUPT;
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (dict->codec == PTAR_CODEC_ZSTD)
+    {
+      if (NULL == dict->ddict)
+        {
+          dict->ddict = ZSTD_createDDict (dict->data, dict->size);
+          dict->dctx = ZSTD_createDCtx ();
+        }
+      if (NULL == dict->ddict || NULL == dict->dctx)
+        {
+          return PTAR_EFAILURE;
+        }
+      return ZSTD_decompress_usingDDict (dict->dctx, out, size, in, len,
+                                         dict->ddict) == size ?
+          PTAR_ESUCCESS : PTAR_ECORRUPT;
+    }
+#endif
+  (void) out;
+  (void) size;
+  (void) in;
+  (void) len;
+  return PTAR_ENOTSUP;
+}
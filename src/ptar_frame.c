@@ -0,0 +1,473 @@
+/*
+ * ptar_frame.c
+ *  Module     : ptar
+ *  Description: Framed members. The payload of a member is cut into frames
+ *               that are compressed independently, so that any byte range
+ *               can be read by decoding only the frames that hold it.
+ *
+ *               Payload layout, integers little endian:
+ *                 frame 0 .. frame n-1
+ *                 n x u32   end offset of each frame in the payload
+ *                 trailer   "PTARFRM1", codec, frame size, n, size,
+ *                           dictionary id (0: none, see ptar_dict.c), 0
+ *               A frame whose stored length equals its size is not compressed.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ptar_private.h"
+#ifdef PTAR_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef PTAR_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define FRAME_MAGIC     "PTARFRM1"
+#define FRAME_TRAILER   32
+
+struct frame_trailer
+{
+  unsigned codec;
+  unsigned frame_size;
+  unsigned nframes;
+  unsigned size;
+  unsigned dict_id;
+};
+
+/* Trailer of the framed member read last, and the last frame decoded from
+ * it, so a member read in small pieces decodes each frame once */
+struct ptar_frames
+{
+  unsigned data_pos;
+  unsigned stored;
+  struct frame_trailer t;
+  /* Frame held in out, FRAME_NONE if none */
+  unsigned frame;
+  unsigned char *in;
+  unsigned char *out;
+};
+
+#define FRAME_NONE      0xffffffffu
+
+static void
+put32 (unsigned char *p, unsigned v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static unsigned
+get32 (const unsigned char *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (unsigned) p[3] << 24;
+}
+
+static int
+frame_codec_supported (int codec)
+{
+  switch (codec)
+    {
+    case PTAR_CODEC_NONE:
+      return 1;
+#ifdef PTAR_HAVE_ZLIB
+    case PTAR_CODEC_ZLIB:
+      return 1;
+#endif
+#ifdef PTAR_HAVE_ZSTD
+    case PTAR_CODEC_ZSTD:
+      return 1;
+#endif
+    default:
+      return 0;
+    }
+}
+
+static unsigned
+frame_bound (int codec, unsigned size)
+{
+#ifdef PTAR_HAVE_ZLIB
+  if (codec == PTAR_CODEC_ZLIB)
+    {
+      return compressBound (size);
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (codec == PTAR_CODEC_ZSTD)
+    {
+      return ZSTD_compressBound (size);
+    }
+#endif
+  return size;
+}
+
+/* Compress one frame into out. Returns the stored length, which is the
+ * frame size itself when compressing did not pay off */
+static unsigned
+frame_encode (int codec, struct ptar_dict *dict, unsigned char *out,
+              const unsigned char *in, unsigned size)
+{
+  if (dict)
+    {
+      unsigned n = ptar_dict_encode (dict, out, frame_bound (codec, size), in, size);
+      if (n && n < size)
+        {
+          return n;
+        }
+      memcpy (out, in, size);
+      return size;
+    }
+#ifdef PTAR_HAVE_ZLIB
+  uLongf len = compressBound (size);
+  if (codec == PTAR_CODEC_ZLIB
+      && Z_OK == compress2 (out, &len, in, size, Z_DEFAULT_COMPRESSION)
+      && len < size)
+    {
+      return len;
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (codec == PTAR_CODEC_ZSTD)
+    {
+      size_t n = ZSTD_compress (out, ZSTD_compressBound (size), in, size,
+                                PTAR_ZSTD_LEVEL);
+      if (!ZSTD_isError (n) && n < size)
+        {
+          return n;
+        }
+    }
+#endif
+  memcpy (out, in, size);
+  return size;
+}
+
+static int
+frame_decode (int codec, struct ptar_dict *dict, unsigned char *out,
+              unsigned size, const unsigned char *in, unsigned len)
+{
+  if (len == size)
+    {
+      memcpy (out, in, size);
+      return PTAR_ESUCCESS;
+    }
+  if (dict)
+    {
+      return ptar_dict_decode (dict, out, size, in, len);
+    }
+#ifdef PTAR_HAVE_ZLIB
+  if (codec == PTAR_CODEC_ZLIB)
+    {
+      uLongf n = size;
+      if (Z_OK != uncompress (out, &n, in, len) || n != size)
+        {
+          return PTAR_ECORRUPT;
+        }
+      return PTAR_ESUCCESS;
+    }
+#endif
+#ifdef PTAR_HAVE_ZSTD
+  if (codec == PTAR_CODEC_ZSTD)
+    {
+      if (ZSTD_decompress (out, size, in, len) != size)
+        {
+          return PTAR_ECORRUPT;
+        }
+      return PTAR_ESUCCESS;
+    }
+#endif
+  return codec == PTAR_CODEC_NONE ? PTAR_ECORRUPT : PTAR_ENOTSUP;
+}
+
+void
+ptar_frame_forget (ptar_t *tar)
+{
+  if (tar->frames)
+    {
+      free (tar->frames->in);
+      free (tar->frames->out);
+      free (tar->frames);
+      tar->frames = NULL;
+    }
+}
+
+/* Keep the trailer of the member at data_pos, with buffers for one of its
+ * frames. Without memory nothing is kept */
+static void
+frames_keep (ptar_t *tar, unsigned data_pos, unsigned stored,
+             const struct frame_trailer *t)
+{
+  struct ptar_frames *f;
+
+  ptar_frame_forget (tar);
+  f = calloc (1, sizeof(struct ptar_frames));
+  if (f)
+    {
+      f->in = malloc (frame_bound (t->codec, t->frame_size));
+      f->out = malloc (t->frame_size);
+    }
+  if (NULL == f || NULL == f->in || NULL == f->out)
+    {
+      tar->frames = f;
+      ptar_frame_forget (tar);
+      return;
+    }
+  f->data_pos = data_pos;
+  f->stored = stored;
+  f->t = *t;
+  f->frame = FRAME_NONE;
+  tar->frames = f;
+}
+
+static int
+read_trailer (ptar_t *tar, unsigned data_pos, unsigned stored,
+              struct frame_trailer *t)
+{
+  int err;
+  unsigned char raw[FRAME_TRAILER];
+  struct ptar_frames *f = tar->frames;
+
+  if (f && f->data_pos == data_pos && f->stored == stored)
+    {
+      *t = f->t;
+      return PTAR_ESUCCESS;
+    }
+  if (stored < FRAME_TRAILER)
+    {
+      return PTAR_ECORRUPT;
+    }
+  err = ptar_seek (tar, data_pos + stored - FRAME_TRAILER);
+  if (err == PTAR_ESUCCESS)
+    {
+      err = tread (tar, raw, FRAME_TRAILER);
+    }
+  if (err)
+    {
+      return err;
+    }
+  if (memcmp (raw, FRAME_MAGIC, 8))
+    {
+      return PTAR_ECORRUPT;
+    }
+  t->codec = get32 (raw + 8);
+  t->frame_size = get32 (raw + 12);
+  t->nframes = get32 (raw + 16);
+  t->size = get32 (raw + 20);
+  t->dict_id = get32 (raw + 24);
+  if (t->frame_size == 0
+      || t->nframes != (t->size + t->frame_size - 1) / t->frame_size
+      || t->nframes > (stored - FRAME_TRAILER) / 4)
+    {
+      return PTAR_ECORRUPT;
+    }
+  frames_keep (tar, data_pos, stored, t);
+  return PTAR_ESUCCESS;
+}
+
+int
+ptar_frame_size (ptar_t *tar, unsigned data_pos, unsigned stored,
+                 unsigned *size)
+{
+  int err;
+  struct frame_trailer t;
+  err = read_trailer (tar, data_pos, stored, &t);
+  if (err == PTAR_ESUCCESS)
+    {
+      *size = t.size;
+    }
+  return err;
+}
+
+int
+ptar_frame_read (ptar_t *tar, unsigned data_pos, unsigned stored,
+                 unsigned offset, void *ptr, unsigned size)
+{
+  int err;
+  struct frame_trailer t;
+  struct ptar_frames *f;
+  struct ptar_dict *dict = NULL;
+  unsigned k, index_pos, start, end, len, fstart, flen, from, to;
+  unsigned char ends[8], *in = NULL, *out = NULL, *buf;
+  unsigned char *dst = ptr;
+
+  err = read_trailer (tar, data_pos, stored, &t);
+  if (err)
+    {
+      return err;
+    }
+  if (offset > t.size || size > t.size - offset)
+    {
+      return PTAR_EREADFAIL;
+    }
+  if (size == 0)
+    {
+      return PTAR_ESUCCESS;
+    }
+  index_pos = data_pos + stored - FRAME_TRAILER - 4 * t.nframes;
+  f = tar->frames;
+
+  for (k = offset / t.frame_size; err == PTAR_ESUCCESS
+      && k <= (offset + size - 1) / t.frame_size; k++)
+    {
+      fstart = k * t.frame_size;
+      flen = t.size - fstart < t.frame_size ? t.size - fstart : t.frame_size;
+      /* Part of the frame that falls into the range */
+      from = offset > fstart ? offset - fstart : 0;
+      to = offset + size - fstart < flen ? offset + size - fstart : flen;
+      if (f && f->frame == k)
+        {
+          memcpy (dst, f->out + from, to - from);
+          dst += to - from;
+          continue;
+        }
+      /* Frame k spans [end of frame k - 1, end of frame k) */
+      put32 (ends, 0);
+      err = ptar_seek (tar, index_pos + 4 * (k ? k - 1 : 0));
+      if (err == PTAR_ESUCCESS)
+        {
+          err = k ? tread (tar, ends, 8) : tread (tar, ends + 4, 4);
+        }
+      if (err)
+        {
+          break;
+        }
+      start = get32 (ends);
+      end = get32 (ends + 4);
+      len = end - start;
+      if (end < start || end > index_pos - data_pos
+          || len > frame_bound (t.codec, t.frame_size))
+        {
+          err = PTAR_ECORRUPT;
+          break;
+        }
+      if (NULL == dict && t.dict_id
+          && NULL == (dict = ptar_dict_find (tar, t.dict_id)))
+        {
+          err = PTAR_ECORRUPT;
+          break;
+        }
+      /* The kept buffers (looking up the dictionary may have dropped them),
+       * or buffers of this call when nothing could be kept */
+      f = tar->frames && tar->frames->data_pos == data_pos
+          && tar->frames->stored == stored ? tar->frames : NULL;
+      if (NULL == f && NULL == in)
+        {
+          in = malloc (frame_bound (t.codec, t.frame_size));
+          out = malloc (t.frame_size);
+          if (!in || !out)
+            {
+              err = PTAR_EFAILURE;
+              break;
+            }
+        }
+      buf = f ? f->in : in;
+      err = ptar_seek (tar, data_pos + start);
+      if (err == PTAR_ESUCCESS)
+        {
+          err = tread (tar, buf, len);
+        }
+      if (err)
+        {
+          break;
+        }
+      if (from == 0 && to == flen)
+        {
+          /* Whole frame wanted: decode straight into the caller buffer */
+          err = frame_decode (t.codec, dict, dst, flen, buf, len);
+        }
+      else
+        {
+          /* Part of it: keep it for the reads of the rest */
+          err = frame_decode (t.codec, dict, f ? f->out : out, flen, buf, len);
+          if (f)
+            {
+              f->frame = err == PTAR_ESUCCESS ? k : FRAME_NONE;
+            }
+          if (err == PTAR_ESUCCESS)
+            {
+              memcpy (dst, (f ? f->out : out) + from, to - from);
+            }
+        }
+      dst += to - from;
+    }
+
+  free (in);
+  free (out);
+  return err;
+}
+
+int
+ptar_write_file_framed (ptar_t *tar, const char *name, const void *data,
+                        unsigned size, int codec, unsigned frame_size)
+{
+  int err;
+  ptar_header_t h;
+  unsigned k, n, len, off = 0;
+  unsigned char *buf, *p;
+  const unsigned char *src = data;
+  /* Members compressed with the codec of the dictionary use it */
+  struct ptar_dict *dict = tar->dict && tar->dict->codec == codec ? tar->dict : NULL;
+
+  if (!frame_codec_supported (codec))
+    {
+      return PTAR_ENOTSUP;
+    }
+  if (frame_size == 0)
+    {
+      frame_size = PTAR_FRAME_SIZE;
+    }
+  n = (size + frame_size - 1) / frame_size;
+
+  /* Frames, then index, then trailer */
+  buf = malloc ((size_t) n * frame_bound (codec, frame_size) + 4 * n
+                + FRAME_TRAILER);
+  if (NULL == buf)
+    {
+      return PTAR_EFAILURE;
+    }
+  p = buf + (size_t) n * frame_bound (codec, frame_size);
+  for (k = 0; k < n; k++)
+    {
+      len = size - k * frame_size < frame_size ? size - k * frame_size : frame_size;
+      off += frame_encode (codec, dict, buf + off, src + (size_t) k * frame_size, len);
+      put32 (p + 4 * k, off);
+    }
+  memmove (buf + off, p, 4 * n);
+  p = buf + off + 4 * n;
+  memset (p, 0, FRAME_TRAILER);
+  memcpy (p, FRAME_MAGIC, 8);
+  put32 (p + 8, codec);
+  put32 (p + 12, frame_size);
+  put32 (p + 16, n);
+  put32 (p + 20, size);
+  put32 (p + 24, dict ? dict->id : 0);
+
+  memset (&h, 0, sizeof(h));
+  strcpy (h.name, name);
+  h.size = off + 4 * n + FRAME_TRAILER;
+  h.type = PTAR_TFRAMED;
+  h.mode = 0664;
+  err = ptar_write_header (tar, &h);
+  if (err == PTAR_ESUCCESS)
+    {
+      err = ptar_write_data (tar, buf, h.size);
+    }
+  free (buf);
+  return err;
+}
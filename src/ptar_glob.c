@@ -0,0 +1,228 @@
+/*
+ * ptar_glob.c
+ *  Module     : ptar
+ *  Description: Compiled glob patterns for ptar_list_glob. A pattern is
+ *               parsed once into tokens: literal characters, '?', '*' and
+ *               bracket sets ("[a-z]", "[!0-9]"); '\' quotes the next
+ *               character. As with tar's default wildcards, '*' and '?' also
+ *               match '/'.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ptar_private.h"
+
+enum
+{
+  GLOB_CHAR, GLOB_ANY, GLOB_STAR, GLOB_SET
+};
+
+struct glob_token
+{
+  int kind;
+  unsigned char c;
+  /* Bitmap of the characters a GLOB_SET accepts */
+  unsigned char set[32];
+};
+
+struct ptar_glob
+{
+  struct glob_token *token;
+  unsigned ntokens;
+  /* Literal characters before the first wildcard, NUL terminated */
+  char *prefix;
+};
+
+void
+ptar_glob_free (ptar_glob_t *glob)
+{
+  if (glob)
+    {
+      free (glob->token);
+      free (glob->prefix);
+      free (glob);
+    }
+}
+
+/* Parse the set starting after '['. Returns the character after ']', NULL
+ * if the set is not closed */
+static const char *
+parse_set (const char *p, struct glob_token *t)
+{
+  int negate = 0;
+  unsigned i, lo, hi;
+
+  if (*p == '!' || *p == '^')
+    {
+      negate = 1;
+      p++;
+    }
+  /* A ']' right after the opening bracket is a member */
+  do
+    {
+      if (*p == '\0')
+        {
+          return NULL;
+        }
+      lo = hi = (unsigned char) *p++;
+      if (*p == '-' && p[1] != ']' && p[1] != '\0')
+        {
+          hi = (unsigned char) p[1];
+          p += 2;
+        }
+      for (i = lo; i <= hi; i++)
+        {
+          t->set[i / 8] |= 1 << (i % 8);
+        }
+    }
+  while (*p != ']');
+  if (negate)
+    {
+      for (i = 0; i < sizeof(t->set); i++)
+        {
+          t->set[i] = ~t->set[i];
+        }
+    }
+  return p + 1;
+}
+
+ptar_glob_t *
+ptar_glob_compile (const char *pattern)
+{
+  unsigned n = 0, literal = 1;
+  const char *p = pattern;
+  struct glob_token *t;
+  ptar_glob_t *glob = calloc (1, sizeof(ptar_glob_t));
+
+  /* Never more tokens than pattern characters */
+  if (NULL == glob
+      || NULL == (glob->token = calloc (strlen (pattern) + 1, sizeof(*t)))
+      || NULL == (glob->prefix = calloc (strlen (pattern) + 1, 1)))
+    {
+      ptar_glob_free (glob);
+      return NULL;
+    }
+  while (*p)
+    {
+      t = &glob->token[n];
+      switch (*p)
+        {
+        case '?':
+          t->kind = GLOB_ANY;
+          p++;
+          break;
+        case '*':
+          t->kind = GLOB_STAR;
+          /* Runs of stars match the same as one */
+          while (*p == '*')
+            {
+              p++;
+            }
+          break;
+        case '[':
+          t->kind = GLOB_SET;
+          p = parse_set (p + 1, t);
+          if (NULL == p)
+            {
+              PTrace(ERROR_LEVEL, "Unterminated [ in pattern %s", pattern);
+              ptar_glob_free (glob);
+              return NULL;
+            }
+          break;
+        case '\\':
+          /* A trailing backslash stands for itself */
+          t->kind = GLOB_CHAR;
+          t->c = p[1] ? p[1] : '\\';
+          p += p[1] ? 2 : 1;
+          break;
+        default:
+          t->kind = GLOB_CHAR;
+          t->c = *p++;
+          break;
+        }
+      if (t->kind != GLOB_CHAR)
+        {
+          literal = 0;
+        }
+      else if (literal)
+        {
+          glob->prefix[n] = t->c;
+        }
+      n++;
+    }
+  glob->ntokens = n;
+  return glob;
+}
+
+const char *
+ptar_glob_prefix (const ptar_glob_t *glob)
+{
+  return glob->prefix;
+}
+
+static int
+token_match (const struct glob_token *t, unsigned char c)
+{
+  switch (t->kind)
+    {
+    case GLOB_CHAR:
+      return t->c == c;
+    case GLOB_SET:
+      return t->set[c / 8] & (1 << (c % 8));
+    default:
+      return 1;
+    }
+}
+
+int
+ptar_glob_match (const ptar_glob_t *glob, const char *name)
+{
+  /* Backtracking needs only the last star: on a mismatch it takes one more
+   * character and matching resumes after it */
+  unsigned i = 0, star_i = 0;
+  const char *star_name = NULL;
+
+  while (*name)
+    {
+      if (i < glob->ntokens && glob->token[i].kind == GLOB_STAR)
+        {
+          star_i = ++i;
+          star_name = name;
+        }
+      else if (i < glob->ntokens
+          && token_match (&glob->token[i], (unsigned char) *name))
+        {
+          i++;
+          name++;
+        }
+      else if (star_name)
+        {
+          i = star_i;
+          name = ++star_name;
+        }
+      else
+        {
+          return 0;
+        }
+    }
+  while (i < glob->ntokens && glob->token[i].kind == GLOB_STAR)
+    {
+      i++;
+    }
+  return i == glob->ntokens;
+}
@@ -0,0 +1,568 @@
+/*
+ * ptar_index.c
+ *  Module     : ptar
+ *  Description: In-memory member index. One scan of the headers fills a hash
+ *               table of name hash -> header offset, fronted by a Bloom filter
+ *               so that names not in the archive are turned away without
+ *               reading anything, and a name sorted member list for prefix
+ *               and glob listings. Members written afterwards are added as
+ *               they are written.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ptar_private.h"
+
+#define INDEX_MIN_SLOTS 64
+/* Bloom filter: 10 bits and 7 probes per member, about 1% false positives */
+#define BLOOM_BITS_PER_MEMBER 10
+#define BLOOM_HASHES    7
+#define BLOOM_MIN_BITS  1024
+/* Names are copied into blocks of this size, which never move */
+#define NAME_BLOCK      (64 * 1024)
+
+struct index_slot
+{
+  uint64_t hash;
+  /* Header offset + 1, 0 for a free slot */
+  unsigned pos;
+  /* The member's index_entry */
+  unsigned entry;
+};
+
+struct index_entry
+{
+  uint64_t hash;
+  const char *name;
+  unsigned pos;
+  /* Stored size; logical sizes are looked up for framed and sparse members */
+  unsigned size;
+  unsigned type;
+};
+
+struct name_block
+{
+  struct name_block *next;
+  unsigned used;
+  char data[NAME_BLOCK];
+};
+
+struct ptar_index
+{
+  struct index_entry *entry;
+  unsigned nentries;
+  unsigned capacity;
+  /* entry[0, nsorted) is in name order, later entries were appended */
+  unsigned nsorted;
+  struct name_block *names;
+  struct index_slot *slot;
+  unsigned nslots;
+  unsigned count;
+  uint64_t *bloom;
+  unsigned bloom_bits;
+  /* Offset of the end-of-archive marker */
+  unsigned end;
+  unsigned lookups;
+  unsigned bloom_negatives;
+  unsigned false_positives;
+};
+
+static void
+bloom_set (struct ptar_index *index, uint64_t hash)
+{
+  unsigned i, bit;
+  unsigned h1 = hash, h2 = (hash >> 32) | 1;
+  for (i = 0; i < BLOOM_HASHES; i++)
+    {
+      bit = (h1 + i * h2) & (index->bloom_bits - 1);
+      index->bloom[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static int
+bloom_test (const struct ptar_index *index, uint64_t hash)
+{
+  unsigned i, bit;
+  unsigned h1 = hash, h2 = (hash >> 32) | 1;
+  for (i = 0; i < BLOOM_HASHES; i++)
+    {
+      bit = (h1 + i * h2) & (index->bloom_bits - 1);
+      if (!(index->bloom[bit / 64] & (1ULL << (bit % 64))))
+        {
+          return 0;
+        }
+    }
+  return 1;
+}
+
+/* Size the filter for count members and fill it from the table */
+static int
+bloom_build (struct ptar_index *index, unsigned count)
+{
+  unsigned i, bits = BLOOM_MIN_BITS;
+  uint64_t *bloom;
+  while (bits < count * BLOOM_BITS_PER_MEMBER)
+    {
+      bits *= 2;
+    }
+  bloom = calloc (bits / 64, sizeof(uint64_t));
+  if (NULL == bloom)
+    {
+      return PTAR_EFAILURE;
+    }
+  free (index->bloom);
+  index->bloom = bloom;
+  index->bloom_bits = bits;
+  for (i = 0; i < index->nslots; i++)
+    {
+      if (index->slot[i].pos)
+        {
+          bloom_set (index, index->slot[i].hash);
+        }
+    }
+  return PTAR_ESUCCESS;
+}
+
+static int
+index_insert (struct ptar_index *index, uint64_t hash, unsigned pos,
+              unsigned entry)
+{
+  unsigned i, n, nold = index->nslots;
+  struct index_slot *old = index->slot;
+
+  /* Open addressing: keep the table at most 3/4 full */
+  if (4 * (index->count + 1) > 3 * index->nslots)
+    {
+      n = nold ? 2 * nold : INDEX_MIN_SLOTS;
+      index->slot = calloc (n, sizeof(struct index_slot));
+      if (NULL == index->slot)
+        {
+          index->slot = old;
+          return PTAR_EFAILURE;
+        }
+      index->nslots = n;
+      index->count = 0;
+      for (i = 0; i < nold; i++)
+        {
+          if (old[i].pos)
+            {
+              index_insert (index, old[i].hash, old[i].pos - 1, old[i].entry);
+            }
+        }
+      free (old);
+    }
+  for (i = hash & (index->nslots - 1); index->slot[i].pos;
+      i = (i + 1) & (index->nslots - 1))
+    ;
+  index->slot[i].hash = hash;
+  index->slot[i].pos = pos + 1;
+  index->slot[i].entry = entry;
+  index->count++;
+  /* Refit the filter once it holds twice the members it was sized for */
+  if (index->count * BLOOM_BITS_PER_MEMBER > 2 * index->bloom_bits)
+    {
+      return bloom_build (index, 2 * index->count);
+    }
+  bloom_set (index, hash);
+  return PTAR_ESUCCESS;
+}
+
+static int
+entry_add (struct ptar_index *index, const ptar_header_t *h, unsigned pos,
+           uint64_t hash)
+{
+  unsigned len = strlen (h->name) + 1;
+  struct index_entry *e;
+  struct name_block *b = index->names;
+
+  if (index->nentries == index->capacity)
+    {
+      e = realloc (index->entry, 2 * (index->capacity + 32) * sizeof(*e));
+      if (NULL == e)
+        {
+          return PTAR_EFAILURE;
+        }
+      index->entry = e;
+      index->capacity = 2 * (index->capacity + 32);
+    }
+  if (NULL == b || NAME_BLOCK - b->used < len)
+    {
+      b = malloc (sizeof(struct name_block));
+      if (NULL == b)
+        {
+          return PTAR_EFAILURE;
+        }
+      b->next = index->names;
+      b->used = 0;
+      index->names = b;
+    }
+  e = &index->entry[index->nentries++];
+  e->name = memcpy (b->data + b->used, h->name, len);
+  b->used += len;
+  e->hash = hash;
+  e->pos = pos;
+  e->size = h->size;
+  e->type = h->type;
+  return PTAR_ESUCCESS;
+}
+
+static int
+entry_cmp (const void *a, const void *b)
+{
+  return strcmp (((const struct index_entry*) a)->name,
+                 ((const struct index_entry*) b)->name);
+}
+
+/* Slot of the member at pos whose name hashes to hash, NULL if none */
+static struct index_slot *
+slot_find (struct ptar_index *index, uint64_t hash, unsigned pos)
+{
+  unsigned i;
+  for (i = hash & (index->nslots - 1); index->nslots && index->slot[i].pos;
+      i = (i + 1) & (index->nslots - 1))
+    {
+      if (index->slot[i].hash == hash && index->slot[i].pos == pos + 1)
+        {
+          return &index->slot[i];
+        }
+    }
+  return NULL;
+}
+
+static void
+entries_sort (struct ptar_index *index)
+{
+  unsigned i;
+  struct index_slot *s;
+
+  if (index->nsorted < index->nentries)
+    {
+      qsort (index->entry, index->nentries, sizeof(struct index_entry), entry_cmp);
+      index->nsorted = index->nentries;
+      /* The entries moved: point their slots at them again */
+      for (i = 0; i < index->nentries; i++)
+        {
+          s = slot_find (index, index->entry[i].hash, index->entry[i].pos);
+          if (s)
+            {
+              s->entry = i;
+            }
+        }
+    }
+}
+
+void
+ptar_index_free (struct ptar_index *index)
+{
+  struct name_block *b;
+  if (index)
+    {
+      while ((b = index->names))
+        {
+          index->names = b->next;
+          free (b);
+        }
+      free (index->entry);
+      free (index->slot);
+      free (index->bloom);
+      free (index);
+    }
+}
+
+void
+ptar_index_drop (ptar_t *tar)
+{
+  ptar_index_free (tar->index);
+  tar->index = NULL;
+}
+
+int
+ptar_index_build (ptar_t *tar)
+{
+  int err;
+  unsigned end, count = 0;
+  uint64_t hash;
+  ptar_header_t h;
+  struct ptar_index *index;
+
+  ptar_index_drop (tar);
+  index = calloc (1, sizeof(struct ptar_index));
+  if (NULL == index)
+    {
+      return PTAR_EFAILURE;
+    }
+  err = ptar_rewind (tar);
+  while (err == PTAR_ESUCCESS)
+    {
+      end = tar->pos;
+      err = ptar_load_header (tar, &h);
+      if (err == PTAR_ESUCCESS)
+        {
+          if (h.type != PTAR_TDEAD)
+            {
+              hash = ptar_hash64 (h.name, strlen (h.name));
+              err = index_insert (index, hash, tar->pos, index->nentries);
+              if (err == PTAR_ESUCCESS)
+                {
+                  err = entry_add (index, &h, tar->pos, hash);
+                }
+              count++;
+            }
+          if (err == PTAR_ESUCCESS)
+            {
+              err = ptar_next (tar);
+            }
+        }
+    }
+  /* Headers end at a null record or at the end of the backend */
+  if ((err == PTAR_ENULLRECORD || err == PTAR_EREADFAIL)
+      && bloom_build (index, count) == PTAR_ESUCCESS)
+    {
+      index->end = end;
+      entries_sort (index);
+      tar->index = index;
+      err = PTAR_ESUCCESS;
+    }
+  else
+    {
+      ptar_index_free (index);
+      err = err ? err : PTAR_EFAILURE;
+    }
+  ptar_rewind (tar);
+  return err;
+}
+
+void
+ptar_index_add (ptar_t *tar, const ptar_header_t *h, unsigned pos, unsigned end)
+{
+  struct ptar_index *index = tar->index;
+  uint64_t hash = ptar_hash64 (h->name, strlen (h->name));
+  /* An index that can not keep up is dropped rather than left wrong */
+  if (index_insert (index, hash, pos, index->nentries)
+      || entry_add (index, h, pos, hash))
+    {
+      ptar_index_drop (tar);
+      return;
+    }
+  if (end > index->end)
+    {
+      index->end = end;
+    }
+}
+
+void
+ptar_index_remove (ptar_t *tar, const char *name, unsigned pos)
+{
+  struct ptar_index *index = tar->index;
+  struct index_slot *s = slot_find (index, ptar_hash64 (name, strlen (name)),
+                                    pos);
+  if (s)
+    {
+      index->entry[s->entry].type = PTAR_TDEAD;
+    }
+}
+
+int
+ptar_index_find (ptar_t *tar, const char *name, ptar_header_t *h)
+{
+  int err;
+  unsigned i;
+  ptar_header_t header;
+  struct ptar_index *index = tar->index;
+  uint64_t hash = ptar_hash64 (name, strlen (name));
+
+  index->lookups++;
+  if (!bloom_test (index, hash))
+    {
+      index->bloom_negatives++;
+      return PTAR_ENOTFOUND;
+    }
+  /* Candidates are confirmed against their header, which also skips members
+   * deleted since the index was built */
+  for (i = hash & (index->nslots - 1); index->slot[i].pos;
+      i = (i + 1) & (index->nslots - 1))
+    {
+      if (index->slot[i].hash != hash)
+        {
+          continue;
+        }
+      tar->remaining_data = 0;
+      err = ptar_seek (tar, index->slot[i].pos - 1);
+      if (err == PTAR_ESUCCESS)
+        {
+          err = ptar_load_header (tar, &header);
+        }
+      if (err)
+        {
+          return err;
+        }
+      if (header.type != PTAR_TDEAD && !strcmp (header.name, name))
+        {
+          return h ? ptar_read_header (tar, h) : PTAR_ESUCCESS;
+        }
+    }
+  index->false_positives++;
+  return PTAR_ENOTFOUND;
+}
+
+int
+ptar_index_end (ptar_t *tar)
+{
+  tar->remaining_data = 0;
+  tar->last_header = tar->index->end;
+  return ptar_seek (tar, tar->index->end);
+}
+
+int
+ptar_index_stats (ptar_t *tar, ptar_index_stats_t *stats)
+{
+  unsigned i, k, set = 0;
+  uint64_t w;
+  struct ptar_index *index = tar->index;
+  if (NULL == index)
+    {
+      return PTAR_EFAILURE;
+    }
+  for (i = 0; i < index->bloom_bits / 64; i++)
+    {
+      for (w = index->bloom[i]; w; w &= w - 1)
+        {
+          set++;
+        }
+    }
+  stats->members = index->count;
+  stats->bloom_bits = index->bloom_bits;
+  stats->bloom_hashes = BLOOM_HASHES;
+  stats->lookups = index->lookups;
+  stats->bloom_negatives = index->bloom_negatives;
+  stats->false_positives = index->false_positives;
+  /* A name not in the archive passes if all its probes hit set bits */
+  stats->fp_rate = 1.0;
+  for (k = 0; k < BLOOM_HASHES; k++)
+    {
+      stats->fp_rate *= (double) set / index->bloom_bits;
+    }
+  return PTAR_ESUCCESS;
+}
+
+/* Report one listed member. Sizes of framed and sparse members need their
+ * header, the others come from the index */
+static int
+list_entry (ptar_t *tar, const struct index_entry *e, ptar_list_fn fn,
+            void *ctx, int *stop)
+{
+  int err;
+  ptar_entry_t out;
+  ptar_header_t h;
+
+  out.name = e->name;
+  out.offset = e->pos;
+  out.size = e->size;
+  out.type = e->type;
+  if (e->type == PTAR_TFRAMED || e->type == PTAR_TSPARSE)
+    {
+      err = ptar_seek (tar, e->pos);
+      if (err == PTAR_ESUCCESS)
+        {
+          err = ptar_read_header (tar, &h);
+        }
+      if (err)
+        {
+          return err;
+        }
+      out.size = h.size;
+    }
+  *stop = fn (ctx, &out);
+  return PTAR_ESUCCESS;
+}
+
+/* First entry not before key */
+static unsigned
+lower_bound (const struct ptar_index *index, const char *key)
+{
+  unsigned lo = 0, hi = index->nentries, mid;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (strcmp (index->entry[mid].name, key) < 0)
+        {
+          lo = mid + 1;
+        }
+      else
+        {
+          hi = mid;
+        }
+    }
+  return lo;
+}
+
+/* Members whose name starts with prefix and matches glob (if any) */
+static int
+list_range (ptar_t *tar, const char *prefix, const ptar_glob_t *glob,
+            ptar_list_fn fn, void *ctx)
+{
+  int err = PTAR_ESUCCESS, stop = 0;
+  unsigned i, pos, remaining, plen = strlen (prefix);
+  struct ptar_index *index;
+
+  if (NULL == tar->index && (err = ptar_index_build (tar)))
+    {
+      return err;
+    }
+  index = tar->index;
+  entries_sort (index);
+  pos = tar->pos;
+  remaining = tar->remaining_data;
+  for (i = lower_bound (index, prefix); err == PTAR_ESUCCESS && !stop
+      && i < index->nentries && !strncmp (index->entry[i].name, prefix, plen); i++)
+    {
+      if (index->entry[i].type != PTAR_TDEAD
+          && (NULL == glob || ptar_glob_match (glob, index->entry[i].name)))
+        {
+          err = list_entry (tar, &index->entry[i], fn, ctx, &stop);
+        }
+    }
+  /* Sizes looked up on the way moved the position */
+  if (tar->pos != pos)
+    {
+      tar->remaining_data = remaining;
+      return err ? err : ptar_seek (tar, pos);
+    }
+  return err;
+}
+
+int
+ptar_list_prefix (ptar_t *tar, const char *prefix, ptar_list_fn fn, void *ctx)
+{
+  return list_range (tar, prefix, NULL, fn, ctx);
+}
+
+int
+ptar_list_glob (ptar_t *tar, const char *pattern, ptar_list_fn fn, void *ctx)
+{
+  int err;
+  ptar_glob_t *glob = ptar_glob_compile (pattern);
+  if (NULL == glob)
+    {
+      return PTAR_EFAILURE;
+    }
+  /* Only names starting with the literal head of the pattern can match */
+  err = list_range (tar, ptar_glob_prefix (glob), glob, fn, ctx);
+  ptar_glob_free (glob);
+  return err;
+}
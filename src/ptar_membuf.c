@@ -0,0 +1,276 @@
+/*
+ * ptar_membuf.c
+ *  Module     : ptar
+ *  Description: In-memory archive writer. The archive grows in a list of
+ *               geometrically sized arenas so it is never moved while it is
+ *               being built.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <limits.h>
+#include "ptar.h"
+
+/* Arenas double in size, so 32 of them cover the whole unsigned range */
+#define MEMBUF_MAX_CHUNKS 32
+
+struct membuf_chunk
+{
+  unsigned char *data;
+  unsigned start;
+  unsigned capacity;
+};
+
+struct membuf_info
+{
+  ptar_allocator_t alloc;
+  struct membuf_chunk chunk[MEMBUF_MAX_CHUNKS];
+  int nchunks;
+  unsigned size;
+  unsigned capacity;
+};
+
+static void *
+default_alloc (void *ctx, size_t size)
+{
+  (void) ctx;
+  return malloc (size);
+}
+
+static void
+default_free (void *ctx, void *ptr)
+{
+  (void) ctx;
+  free (ptr);
+}
+
+/* Make sure [0, end) is backed by arenas */
+static int
+membuf_reserve (struct membuf_info *info, unsigned end)
+{
+  unsigned cap;
+  struct membuf_chunk *c;
+  while (info->capacity < end)
+    {
+      if (info->nchunks == MEMBUF_MAX_CHUNKS)
+        {
+          return PTAR_EWRITEFAIL;
+        }
+      /* Next arena is as large as everything so far */
+      cap = info->capacity ? info->capacity : PTAR_MEMBUF_CHUNK;
+      if (cap < end - info->capacity)
+        {
+          cap = end - info->capacity;
+        }
+      if (cap > UINT_MAX - info->capacity)
+        {
+          cap = UINT_MAX - info->capacity;
+        }
+      c = &info->chunk[info->nchunks];
+      c->data = info->alloc.alloc (info->alloc.ctx, cap);
+      if (NULL == c->data)
+        {
+          PTrace(ERROR_LEVEL, "Failed to allocate arena of %u bytes", cap);
+          return PTAR_EWRITEFAIL;
+        }
+      c->start = info->capacity;
+      c->capacity = cap;
+      info->capacity += cap;
+      info->nchunks++;
+    }
+  return PTAR_ESUCCESS;
+}
+
+/* Copy between the arenas and a flat buffer, starting at archive offset pos */
+static void
+membuf_copy (struct membuf_info *info, unsigned pos, unsigned char *ptr,
+             unsigned size, int to_arena)
+{
+  int i;
+  unsigned off, len;
+  for (i = 0; i < info->nchunks && size; i++)
+    {
+      struct membuf_chunk *c = &info->chunk[i];
+      if (pos >= c->start + c->capacity)
+        {
+          continue;
+        }
+      off = pos - c->start;
+      len = c->capacity - off < size ? c->capacity - off : size;
+      if (to_arena)
+        {
+          memcpy (c->data + off, ptr, len);
+        }
+      else
+        {
+          memcpy (ptr, c->data + off, len);
+        }
+      pos += len;
+      ptr += len;
+      size -= len;
+    }
+}
+
+static int
+membuf_write (ptar_t *tar, const void *data, unsigned size)
+{
+  struct membuf_info *info = tar->stream;
+  if (NULL == info || tar->pos > info->size || tar->pos + size < tar->pos)
+    {
+      return PTAR_EWRITEFAIL;
+    }
+  if (membuf_reserve (info, tar->pos + size))
+    {
+      return PTAR_EWRITEFAIL;
+    }
+  membuf_copy (info, tar->pos, (unsigned char*) data, size, 1);
+  if (tar->pos + size > info->size)
+    {
+      info->size = tar->pos + size;
+    }
+  return PTAR_ESUCCESS;
+}
+
+static int
+membuf_read (ptar_t *tar, void *data, unsigned size)
+{
+  struct membuf_info *info = tar->stream;
+  if (NULL == info || tar->pos > info->size || size > info->size - tar->pos)
+    {
+      return PTAR_EREADFAIL;
+    }
+  membuf_copy (info, tar->pos, data, size, 0);
+  return PTAR_ESUCCESS;
+}
+
+static int
+membuf_seek (ptar_t *tar, unsigned offset)
+{
+  struct membuf_info *info = tar->stream;
+  if (NULL == info || offset > info->size)
+    {
+      return PTAR_ESEEKFAIL;
+    }
+  return PTAR_ESUCCESS;
+}
+
+static int
+membuf_close (ptar_t *tar)
+{
+  int i;
+  struct membuf_info *info = tar->stream;
+  if (NULL == info)
+    {
+      return PTAR_EFAILURE;
+    }
+  for (i = 0; i < info->nchunks; i++)
+    {
+      info->alloc.free (info->alloc.ctx, info->chunk[i].data);
+    }
+  free (info);
+  tar->stream = NULL;
+  return PTAR_ESUCCESS;
+}
+
+int
+ptar_open_membuf (ptar_t *tar, const ptar_allocator_t *allocator)
+{
+  struct membuf_info *info;
+
+  /* Init tar struct and functions */
+  memset (tar, 0, sizeof(*tar));
+  tar->write = membuf_write;
+  tar->read = membuf_read;
+  tar->seek = membuf_seek;
+  tar->close = membuf_close;
+
+  info = calloc (1, sizeof(struct membuf_info));
+  if (NULL == info)
+    {
+      return PTAR_EOPENFAIL;
+    }
+  if (allocator)
+    {
+      info->alloc = *allocator;
+    }
+  else
+    {
+      info->alloc.alloc = default_alloc;
+      info->alloc.free = default_free;
+    }
+  tar->stream = info;
+  return PTAR_ESUCCESS;
+}
+
+int
+ptar_membuf_data (ptar_t *tar, const void **data, unsigned *size)
+{
+  int i;
+  struct membuf_chunk c;
+  struct membuf_info *info = tar->stream;
+  if (NULL == info || tar->write != membuf_write)
+    {
+      return PTAR_EFAILURE;
+    }
+  /* More than one arena in use: coalesce once into a single arena */
+  if (info->nchunks > 1 && info->size > info->chunk[0].capacity)
+    {
+      c.data = info->alloc.alloc (info->alloc.ctx, info->size);
+      if (NULL == c.data)
+        {
+          return PTAR_EFAILURE;
+        }
+      membuf_copy (info, 0, c.data, info->size, 0);
+      for (i = 0; i < info->nchunks; i++)
+        {
+          info->alloc.free (info->alloc.ctx, info->chunk[i].data);
+        }
+      c.start = 0;
+      c.capacity = info->size;
+      info->chunk[0] = c;
+      info->nchunks = 1;
+      info->capacity = info->size;
+    }
+  *data = info->nchunks ? info->chunk[0].data : NULL;
+  *size = info->size;
+  return PTAR_ESUCCESS;
+}
+
+#ifdef POSIX_SYSTEM
+int
+ptar_membuf_iov (ptar_t *tar, struct iovec *iov, int iovcnt)
+{
+  int i, n = 0;
+  struct membuf_info *info = tar->stream;
+  if (NULL == info || tar->write != membuf_write)
+    {
+      return PTAR_EFAILURE;
+    }
+  for (i = 0; i < info->nchunks && info->chunk[i].start < info->size; i++, n++)
+    {
+      struct membuf_chunk *c = &info->chunk[i];
+      if (n < iovcnt)
+        {
+          iov[n].iov_base = c->data;
+          iov[n].iov_len = info->size - c->start < c->capacity ?
+              info->size - c->start : c->capacity;
+        }
+    }
+  return n;
+}
+#endif
@@ -0,0 +1,193 @@
+/*
+ * ptar_private.h
+ *  Module     : ptar
+ *  Description: Declarations shared by the ptar translation units. Not
+ *               installed, not part of the API.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_PTAR_PRIVATE_H_
+#define SRC_PTAR_PRIVATE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "ptar.h"
+
+typedef struct
+{
+  char name[100];
+  char mode[8];
+  char owner[8];
+  char group[8];
+  char size[12];
+  char mtime[12];
+  char checksum[8];
+  char type;
+  char linkname[100];
+  char _padding[255];
+} ptar_raw_header_t;
+
+static inline unsigned
+round_up (unsigned n, unsigned incr)
+{
+  return n + (incr - n % incr) % incr;
+}
+
+static inline int
+tread (ptar_t *tar, void *data, unsigned size)
+{
+  int err = tar->read (tar, data, size);
+  tar->pos += size;
+  return err;
+}
+
+/* ptar_frame.c: drop the frame kept from the last framed member read */
+void
+ptar_frame_forget (ptar_t *tar);
+
+static inline int
+twrite (ptar_t *tar, const void *data, unsigned size)
+{
+  int err;
+  /* What is written may be the member a frame was kept from */
+  if (tar->frames)
+    {
+      ptar_frame_forget (tar);
+    }
+  err = tar->write (tar, data, size);
+  tar->pos += size;
+  return err;
+}
+
+/* Eight bytes per step, multiply-xorshift mixing. Not cryptographic: users
+ * confirm matches against the archive */
+static inline uint64_t
+ptar_hash64 (const void *data, unsigned n)
+{
+  const uint64_t m = 0x9e3779b97f4a7c15ULL;
+  const unsigned char *p = data;
+  uint64_t h = n * m, k;
+  while (n >= 8)
+    {
+      memcpy (&k, p, 8);
+      k *= m;
+      k ^= k >> 29;
+      h = (h ^ k) * m;
+      p += 8;
+      n -= 8;
+    }
+  k = 0;
+  memcpy (&k, p, n);
+  h = (h ^ k) * m;
+  h ^= h >> 32;
+  return h;
+}
+
+/* Raw header with the common fields of h, and its checksum recomputed after
+ * more fields were filled in */
+int
+ptar_header_to_raw (ptar_raw_header_t *rh, const ptar_header_t *h);
+void
+ptar_raw_seal (ptar_raw_header_t *rh);
+
+/* Header as stored: size is the number of payload bytes in the archive.
+ * ptar_read_header reports the logical size of framed members instead. */
+int
+ptar_load_header (ptar_t *tar, ptar_header_t *h);
+
+/* ptar_frame.c */
+int
+ptar_frame_size (ptar_t *tar, unsigned data_pos, unsigned stored,
+                 unsigned *size);
+int
+ptar_frame_read (ptar_t *tar, unsigned data_pos, unsigned stored,
+                 unsigned offset, void *ptr, unsigned size);
+
+/* ptar_sparse.c */
+int
+ptar_sparse_stored (ptar_t *tar, const ptar_raw_header_t *rh, unsigned *size);
+int
+ptar_sparse_size (ptar_t *tar, unsigned header_pos, unsigned *size);
+int
+ptar_sparse_read (ptar_t *tar, unsigned header_pos, unsigned offset,
+                  void *ptr, unsigned size);
+
+/* ptar_dict.c */
+struct ptar_dict
+{
+  unsigned id;
+  int codec;
+  unsigned char *data;
+  unsigned size;
+  /* zstd digested dictionaries and contexts, created on first use */
+  void *cdict;
+  void *ddict;
+  void *cctx;
+  void *dctx;
+};
+
+void
+ptar_dict_free (struct ptar_dict *dict);
+void
+ptar_dicts_free (struct ptar_dicts *dicts);
+/* Dictionary `id` of the archive, loaded once and cached in tar. Where the
+ * dictionaries are is learnt by one scan of the headers */
+struct ptar_dict *
+ptar_dict_find (ptar_t *tar, unsigned id);
+/* Returns the compressed length, 0 on failure */
+unsigned
+ptar_dict_encode (struct ptar_dict *dict, unsigned char *out, unsigned cap,
+                  const unsigned char *in, unsigned size);
+int
+ptar_dict_decode (struct ptar_dict *dict, unsigned char *out, unsigned size,
+                  const unsigned char *in, unsigned len);
+
+/* ptar_index.c */
+void
+ptar_index_free (struct ptar_index *index);
+/* Member h was written at pos and extends up to end */
+void
+ptar_index_add (ptar_t *tar, const ptar_header_t *h, unsigned pos,
+                unsigned end);
+/* Member name at pos was deleted */
+void
+ptar_index_remove (ptar_t *tar, const char *name, unsigned pos);
+int
+ptar_index_find (ptar_t *tar, const char *name, ptar_header_t *h);
+int
+ptar_index_end (ptar_t *tar);
+
+/* ptar_glob.c */
+typedef struct ptar_glob ptar_glob_t;
+
+/* NULL if the pattern is malformed */
+ptar_glob_t *
+ptar_glob_compile (const char *pattern);
+void
+ptar_glob_free (ptar_glob_t *glob);
+/* Literal head of the pattern, which every match starts with */
+const char *
+ptar_glob_prefix (const ptar_glob_t *glob);
+int
+ptar_glob_match (const ptar_glob_t *glob, const char *name);
+
+/* ptar_dedup.c */
+void
+ptar_dedup_free (struct ptar_dedup *dedup);
+
+#endif /* SRC_PTAR_PRIVATE_H_ */
@@ -0,0 +1,510 @@
+/*
+ * ptar_sparse.c
+ *  Module     : ptar
+ *  Description: Sparse files, in the GNU 'S' format. The header lists the
+ *               data segments of the file (offset, length) and its real size;
+ *               segments that do not fit in the header go to extension
+ *               records between the header and the data. Only the segments'
+ *               bytes are stored.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <string.h>
+#include <limits.h>
+#include "ptar_private.h"
+
+#define RECORD          sizeof(ptar_raw_header_t)
+/* GNU header layout */
+#define GNU_MAGIC       257
+#define SPARSE_MAP      386
+#define SPARSE_ENTRY    24
+#define SPARSE_IN_HDR   4
+#define IS_EXTENDED     482
+#define REAL_SIZE       483
+/* Extension record layout */
+#define SPARSE_IN_EXT   21
+#define EXT_EXTENDED    504
+
+/* Size of the chunks copied between files and the archive */
+#define COPY_CHUNK      (64 * 1024)
+
+struct sparse_map
+{
+  unsigned n;
+  unsigned *off;
+  unsigned *len;
+  unsigned real_size;
+  unsigned data_pos;
+};
+
+/* Octal fields of the GNU header are not always NUL terminated */
+static unsigned
+get_octal (const unsigned char *p, unsigned n)
+{
+  unsigned v = 0;
+  while (n-- && *p == ' ')
+    {
+      p++;
+    }
+  for (; n && *p >= '0' && *p <= '7'; n--, p++)
+    {
+      v = v * 8 + (*p - '0');
+    }
+  return v;
+}
+
+static void
+put_octal (unsigned char *p, unsigned v)
+{
+  sprintf ((char*) p, "%011o", v);
+}
+
+static void
+sparse_map_free (struct sparse_map *m)
+{
+  free (m->off);
+  free (m->len);
+}
+
+static int
+sparse_map_add (struct sparse_map *m, unsigned off, unsigned len)
+{
+  unsigned *p;
+  /* Grow at powers of two */
+  if ((m->n & (m->n - 1)) == 0)
+    {
+      p = realloc (m->off, 2 * (m->n + 1) * sizeof(unsigned));
+      if (NULL == p)
+        {
+          return PTAR_EFAILURE;
+        }
+      m->off = p;
+      p = realloc (m->len, 2 * (m->n + 1) * sizeof(unsigned));
+      if (NULL == p)
+        {
+          return PTAR_EFAILURE;
+        }
+      m->len = p;
+    }
+  m->off[m->n] = off;
+  m->len[m->n] = len;
+  m->n++;
+  return PTAR_ESUCCESS;
+}
+
+/* Entries of one record, up to the first empty one */
+static int
+sparse_map_parse (struct sparse_map *m, const unsigned char *p, unsigned n)
+{
+  unsigned i;
+  for (i = 0; i < n && p[i * SPARSE_ENTRY]; i++)
+    {
+      if (sparse_map_add (m, get_octal (p + i * SPARSE_ENTRY, 12),
+                          get_octal (p + i * SPARSE_ENTRY + 12, 12)))
+        {
+          return PTAR_EFAILURE;
+        }
+    }
+  return PTAR_ESUCCESS;
+}
+
+static int
+sparse_map_load (ptar_t *tar, unsigned header_pos, struct sparse_map *m)
+{
+  int err;
+  unsigned char rec[RECORD];
+  int ext;
+
+  memset (m, 0, sizeof(*m));
+  err = ptar_seek (tar, header_pos);
+  if (err == PTAR_ESUCCESS)
+    {
+      err = tread (tar, rec, RECORD);
+    }
+  if (err)
+    {
+      return err;
+    }
+  m->real_size = get_octal (rec + REAL_SIZE, 12);
+  err = sparse_map_parse (m, rec + SPARSE_MAP, SPARSE_IN_HDR);
+  ext = rec[IS_EXTENDED];
+  while (err == PTAR_ESUCCESS && ext)
+    {
+      err = tread (tar, rec, RECORD);
+      if (err == PTAR_ESUCCESS)
+        {
+          err = sparse_map_parse (m, rec, SPARSE_IN_EXT);
+          ext = rec[EXT_EXTENDED];
+        }
+    }
+  m->data_pos = tar->pos;
+  if (err)
+    {
+      sparse_map_free (m);
+    }
+  return err;
+}
+
+int
+ptar_sparse_stored (ptar_t *tar, const ptar_raw_header_t *rh, unsigned *size)
+{
+  int err = PTAR_ESUCCESS;
+  unsigned char rec[RECORD];
+  unsigned pos = tar->pos, n = 0;
+  int ext = ((const unsigned char*) rh)[IS_EXTENDED];
+
+  while (err == PTAR_ESUCCESS && ext)
+    {
+      n++;
+      err = ptar_seek (tar, pos + n * RECORD);
+      if (err == PTAR_ESUCCESS)
+        {
+          err = tread (tar, rec, RECORD);
+        }
+      ext = err == PTAR_ESUCCESS && rec[EXT_EXTENDED];
+    }
+  if (n && err == PTAR_ESUCCESS)
+    {
+      err = ptar_seek (tar, pos);
+    }
+  *size += n * RECORD;
+  return err;
+}
+
+int
+ptar_sparse_size (ptar_t *tar, unsigned header_pos, unsigned *size)
+{
+  int err;
+  unsigned char rec[RECORD];
+  err = ptar_seek (tar, header_pos);
+  if (err == PTAR_ESUCCESS)
+    {
+      err = tread (tar, rec, RECORD);
+    }
+  if (err == PTAR_ESUCCESS)
+    {
+      *size = get_octal (rec + REAL_SIZE, 12);
+    }
+  return err;
+}
+
+int
+ptar_sparse_read (ptar_t *tar, unsigned header_pos, unsigned offset,
+                  void *ptr, unsigned size)
+{
+  int err;
+  struct sparse_map m;
+  unsigned i, d = 0, from, to;
+  unsigned char *dst = ptr;
+
+  err = sparse_map_load (tar, header_pos, &m);
+  if (err)
+    {
+      return err;
+    }
+  if (offset > m.real_size || size > m.real_size - offset)
+    {
+      sparse_map_free (&m);
+      return PTAR_EREADFAIL;
+    }
+  memset (dst, 0, size);
+  /* Copy the part of each segment that overlaps the range */
+  for (i = 0; err == PTAR_ESUCCESS && i < m.n; d += m.len[i], i++)
+    {
+      from = m.off[i] > offset ? m.off[i] : offset;
+      to = m.off[i] + m.len[i] < offset + size ? m.off[i] + m.len[i] : offset + size;
+      if (from >= to)
+        {
+          continue;
+        }
+      err = ptar_seek (tar, m.data_pos + d + (from - m.off[i]));
+      if (err == PTAR_ESUCCESS)
+        {
+          err = tread (tar, dst + (from - offset), to - from);
+        }
+    }
+  sparse_map_free (&m);
+  return err;
+}
+
+#ifdef POSIX_SYSTEM
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* Data segments of fd. A file system without SEEK_DATA yields one segment */
+static int
+find_segments (int fd, unsigned size, struct sparse_map *m)
+{
+  off_t data, hole = 0;
+  while (hole < size)
+    {
+      data = lseek (fd, hole, SEEK_DATA);
+      if (data < 0 && errno == ENXIO)
+        {
+          /* Hole up to the end */
+          break;
+        }
+      if (data >= 0)
+        {
+          hole = lseek (fd, data, SEEK_HOLE);
+        }
+      if (data < 0 || hole < 0)
+        {
+          m->n = 0;
+          return sparse_map_add (m, 0, size);
+        }
+      if (sparse_map_add (m, data, hole - data))
+        {
+          return PTAR_EFAILURE;
+        }
+    }
+  return PTAR_ESUCCESS;
+}
+
+/* Copy [off, off + len) of fd into the member being written */
+static int
+copy_in (ptar_t *tar, int fd, unsigned off, unsigned len, unsigned char *buf)
+{
+  int err;
+  ssize_t n;
+  while (len > 0)
+    {
+      n = pread (fd, buf, len < COPY_CHUNK ? len : COPY_CHUNK, off);
+      if (n <= 0)
+        {
+          PTrace(ERROR_LEVEL, "pread failed at %u, Error : %d", off, errno);
+          return PTAR_EREADFAIL;
+        }
+      err = ptar_write_data (tar, buf, n);
+      if (err)
+        {
+          return err;
+        }
+      off += n;
+      len -= n;
+    }
+  return PTAR_ESUCCESS;
+}
+
+static int
+write_sparse_header (ptar_t *tar, const ptar_header_t *h, struct sparse_map *m,
+                     unsigned real_size)
+{
+  int err;
+  unsigned i, k, n;
+  ptar_raw_header_t rh;
+  unsigned char *p = (unsigned char*) &rh;
+
+  ptar_header_to_raw (&rh, h);
+  memcpy (p + GNU_MAGIC, "ustar  ", 8);
+  put_octal (p + REAL_SIZE, real_size);
+  for (i = 0; i < m->n && i < SPARSE_IN_HDR; i++)
+    {
+      put_octal (p + SPARSE_MAP + i * SPARSE_ENTRY, m->off[i]);
+      put_octal (p + SPARSE_MAP + i * SPARSE_ENTRY + 12, m->len[i]);
+    }
+  p[IS_EXTENDED] = m->n > SPARSE_IN_HDR;
+  ptar_raw_seal (&rh);
+  if (tar->index)
+    {
+      ptar_index_add (tar, h, tar->pos, tar->pos + RECORD
+                      * (1 + (m->n + SPARSE_IN_EXT - 1 - SPARSE_IN_HDR) / SPARSE_IN_EXT)
+                      + h->size + (RECORD - h->size % RECORD) % RECORD);
+    }
+  err = twrite (tar, &rh, RECORD);
+  /* Rest of the map, 21 entries per extension record */
+  while (err == PTAR_ESUCCESS && i < m->n)
+    {
+      memset (&rh, 0, RECORD);
+      n = m->n - i < SPARSE_IN_EXT ? m->n - i : SPARSE_IN_EXT;
+      for (k = 0; k < n; k++, i++)
+        {
+          put_octal (p + k * SPARSE_ENTRY, m->off[i]);
+          put_octal (p + k * SPARSE_ENTRY + 12, m->len[i]);
+        }
+      p[EXT_EXTENDED] = i < m->n;
+      err = twrite (tar, &rh, RECORD);
+    }
+  tar->remaining_data = h->size;
+  return err;
+}
+
+int
+ptar_add_file (ptar_t *tar, const char *name, const char *path)
+{
+  int fd, err;
+  unsigned i, stored = 0;
+  struct stat st;
+  struct sparse_map m;
+  ptar_header_t h;
+  unsigned char *buf;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      PTrace(ERROR_LEVEL, "Failed to open : %s, Error : %d", path, errno);
+      return PTAR_EOPENFAIL;
+    }
+  if (fstat (fd, &st) || !S_ISREG(st.st_mode) || st.st_size > UINT_MAX)
+    {
+      close (fd);
+      return PTAR_ENOTSUP;
+    }
+  memset (&m, 0, sizeof(m));
+  buf = malloc (COPY_CHUNK);
+  err = buf ? find_segments (fd, st.st_size, &m) : PTAR_EFAILURE;
+  for (i = 0; i < m.n; i++)
+    {
+      stored += m.len[i];
+    }
+
+  memset (&h, 0, sizeof(h));
+  strcpy (h.name, name);
+  h.mode = st.st_mode & 07777;
+  h.mtime = st.st_mtime;
+  h.size = stored;
+  if (err == PTAR_ESUCCESS && stored == (unsigned) st.st_size)
+    {
+      /* No holes: a regular member */
+      err = ptar_write_header (tar, &h);
+      for (i = 0; err == PTAR_ESUCCESS && i < m.n; i++)
+        {
+          err = copy_in (tar, fd, m.off[i], m.len[i], buf);
+        }
+    }
+  else if (err == PTAR_ESUCCESS)
+    {
+      /* A trailing hole is kept by an empty last segment at the end */
+      if (m.n == 0 || m.off[m.n - 1] + m.len[m.n - 1] < (unsigned) st.st_size)
+        {
+          err = sparse_map_add (&m, st.st_size, 0);
+        }
+      h.type = PTAR_TSPARSE;
+      if (err == PTAR_ESUCCESS)
+        {
+          err = write_sparse_header (tar, &h, &m, st.st_size);
+        }
+      for (i = 0; err == PTAR_ESUCCESS && i < m.n; i++)
+        {
+          err = copy_in (tar, fd, m.off[i], m.len[i], buf);
+        }
+    }
+  sparse_map_free (&m);
+  free (buf);
+  close (fd);
+  return err;
+}
+
+int
+ptar_extract (ptar_t *tar, const char *name, const char *path)
+{
+  int fd, err;
+  unsigned i, n, d, header_pos;
+  ptar_header_t h;
+  struct sparse_map m;
+  unsigned char *buf;
+
+  err = ptar_find (tar, name, &h);
+  /* A hard link extracts as a copy of its target */
+  if (err == PTAR_ESUCCESS && h.type == PTAR_TLNK)
+    {
+      err = ptar_find (tar, h.linkname, &h);
+    }
+  if (err)
+    {
+      return err;
+    }
+  if (h.type == PTAR_TDIR)
+    {
+      return mkdir (path, h.mode & 07777) && errno != EEXIST ? PTAR_EWRITEFAIL
+          : PTAR_ESUCCESS;
+    }
+  if (h.type != PTAR_TREG && h.type != '\0' && h.type != PTAR_TFRAMED
+      && h.type != PTAR_TSPARSE)
+    {
+      return PTAR_ENOTSUP;
+    }
+  fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, h.mode & 07777 ? h.mode & 07777 : 0644);
+  if (fd < 0)
+    {
+      PTrace(ERROR_LEVEL, "Failed to open : %s, Error : %d", path, errno);
+      return PTAR_EOPENFAIL;
+    }
+  buf = malloc (COPY_CHUNK);
+  if (NULL == buf)
+    {
+      close (fd);
+      return PTAR_EFAILURE;
+    }
+  header_pos = tar->pos;
+  if (h.type == PTAR_TSPARSE)
+    {
+      /* Size the file first, then write the segments: holes stay holes */
+      err = sparse_map_load (tar, header_pos, &m);
+      if (err == PTAR_ESUCCESS)
+        {
+          if (ftruncate (fd, m.real_size))
+            {
+              err = PTAR_EWRITEFAIL;
+            }
+          for (i = 0, d = 0; err == PTAR_ESUCCESS && i < m.n; d += m.len[i], i++)
+            {
+              for (n = 0; err == PTAR_ESUCCESS && n < m.len[i]; n += COPY_CHUNK)
+                {
+                  unsigned len = m.len[i] - n < COPY_CHUNK ? m.len[i] - n : COPY_CHUNK;
+                  err = ptar_seek (tar, m.data_pos + d + n);
+                  if (err == PTAR_ESUCCESS)
+                    {
+                      err = tread (tar, buf, len);
+                    }
+                  if (err == PTAR_ESUCCESS
+                      && pwrite (fd, buf, len, m.off[i] + n) != (ssize_t) len)
+                    {
+                      err = PTAR_EWRITEFAIL;
+                    }
+                }
+            }
+          sparse_map_free (&m);
+        }
+    }
+  else
+    {
+      for (n = 0; err == PTAR_ESUCCESS && n < h.size; n += COPY_CHUNK)
+        {
+          unsigned len = h.size - n < COPY_CHUNK ? h.size - n : COPY_CHUNK;
+          err = ptar_read_range (tar, n, buf, len);
+          if (err == PTAR_ESUCCESS && write (fd, buf, len) != (ssize_t) len)
+            {
+              err = PTAR_EWRITEFAIL;
+            }
+        }
+    }
+  free (buf);
+  if (close (fd) && err == PTAR_ESUCCESS)
+    {
+      err = PTAR_EWRITEFAIL;
+    }
+  ptar_seek (tar, header_pos);
+  return err;
+}
+#endif
@@ -0,0 +1,290 @@
+/*
+ * ptar_stream.c
+ *  Module     : ptar
+ *  Description: Streaming backend. Emits the archive onto any file
+ *               descriptor (pipe, socket, tty, regular file) without seeking
+ *               or mapping it, or reads one from it front to back.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include "ptar.h"
+
+#ifdef POSIX_SYSTEM
+
+struct stream_info
+{
+  int fd;
+  unsigned char *buf;
+  unsigned used;
+  unsigned capacity;
+  /* Set by the first write. A stream is either written or read */
+  int writing;
+  /* Reading: archive position of buf[0] */
+  unsigned base;
+};
+
+/*
+ * Write the whole iovec list, restarting on EINTR, waiting on EAGAIN for
+ * non-blocking descriptors and advancing over short writes.
+ */
+static int
+write_all (int fd, struct iovec *iov, int cnt)
+{
+  ssize_t n;
+  while (cnt > 0)
+    {
+      n = writev (fd, iov, cnt);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            {
+              continue;
+            }
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+              struct pollfd pfd = { fd, POLLOUT, 0 };
+              poll (&pfd, 1, -1);
+              continue;
+            }
+          PTrace(ERROR_LEVEL, "writev failed on fd : %d, Error : %d", fd, errno);
+          return PTAR_EWRITEFAIL;
+        }
+      /* Drop fully written vectors and trim the partially written one */
+      while (cnt > 0 && (size_t) n >= iov->iov_len)
+        {
+          n -= iov->iov_len;
+          iov++;
+          cnt--;
+        }
+      if (cnt > 0)
+        {
+          iov->iov_base = (unsigned char*) iov->iov_base + n;
+          iov->iov_len -= n;
+        }
+    }
+  return PTAR_ESUCCESS;
+}
+
+static int
+stream_flush (struct stream_info *info, const void *data, unsigned size)
+{
+  int err;
+  struct iovec iov[2];
+  int cnt = 0;
+
+  if (info->used)
+    {
+      iov[cnt].iov_base = info->buf;
+      iov[cnt].iov_len = info->used;
+      cnt++;
+    }
+  if (size)
+    {
+      iov[cnt].iov_base = (void*) data;
+      iov[cnt].iov_len = size;
+      cnt++;
+    }
+  err = write_all (info->fd, iov, cnt);
+  info->used = 0;
+  return err;
+}
+
+static int
+stream_write (ptar_t *tar, const void *data, unsigned size)
+{
+  struct stream_info *info = tar->stream;
+  if (NULL == info || (!info->writing && (info->used || tar->pos)))
+    {
+      return PTAR_EWRITEFAIL;
+    }
+  info->writing = 1;
+  /* Small records (headers, padding, small members) are batched */
+  if (size <= info->capacity - info->used)
+    {
+      memcpy (info->buf + info->used, data, size);
+      info->used += size;
+      return PTAR_ESUCCESS;
+    }
+  /* Buffer is full: send the batch and the new data with one writev */
+  return stream_flush (info, data, size);
+}
+
+/* Read from fd until the buffer holds at least want bytes or input ends */
+static int
+stream_fill (struct stream_info *info, unsigned want)
+{
+  ssize_t n;
+  while (info->used < want)
+    {
+      n = read (info->fd, info->buf + info->used, info->capacity - info->used);
+      if (n < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+          struct pollfd pfd = { info->fd, POLLIN, 0 };
+          poll (&pfd, 1, -1);
+          continue;
+        }
+      if (n <= 0)
+        {
+          return PTAR_EREADFAIL;
+        }
+      info->used += n;
+    }
+  return PTAR_ESUCCESS;
+}
+
+/*
+ * Sequential reads. Bytes from the current position on stay buffered until
+ * a later read needs the room, so a read that hits the end of input can be
+ * retried with a smaller size and a header can be read again after a seek
+ * back to it.
+ */
+static int
+stream_read (ptar_t *tar, void *data, unsigned size)
+{
+  int err;
+  unsigned skip;
+  struct stream_info *info = tar->stream;
+  if (NULL == info || info->writing || tar->pos < info->base)
+    {
+      return PTAR_EREADFAIL;
+    }
+  if (tar->pos + size > info->base + info->used)
+    {
+      /* Drop what lies before the position, skipping ahead if needed */
+      skip = tar->pos - info->base;
+      while (skip > info->used)
+        {
+          skip -= info->used;
+          info->base += info->used;
+          info->used = 0;
+          if (stream_fill (info, 1))
+            {
+              return PTAR_EREADFAIL;
+            }
+        }
+      memmove (info->buf, info->buf + skip, info->used - skip);
+      info->used -= skip;
+      info->base += skip;
+      if (size > info->capacity)
+        {
+          /* Larger than the buffer: hand it over a buffer load at a time.
+           * Input that ends early is lost, the archive is truncated anyway */
+          while (size > 0)
+            {
+              err = stream_fill (info, size < info->capacity ? size : info->capacity);
+              if (err)
+                {
+                  return err;
+                }
+              skip = size < info->used ? size : info->used;
+              memcpy (data, info->buf, skip);
+              memmove (info->buf, info->buf + skip, info->used - skip);
+              info->used -= skip;
+              info->base += skip;
+              data = (unsigned char*) data + skip;
+              size -= skip;
+            }
+          return PTAR_ESUCCESS;
+        }
+      err = stream_fill (info, size);
+      if (err)
+        {
+          return err;
+        }
+    }
+  memcpy (data, info->buf + (tar->pos - info->base), size);
+  return PTAR_ESUCCESS;
+}
+
+static int
+stream_seek (ptar_t *tar, unsigned offset)
+{
+  struct stream_info *info = tar->stream;
+  if (NULL == info)
+    {
+      return PTAR_ESEEKFAIL;
+    }
+  /* Writers can not move; readers can go forward or back into the buffer */
+  if (info->writing ? offset == tar->pos : offset >= info->base)
+    {
+      return PTAR_ESUCCESS;
+    }
+  return PTAR_ESEEKFAIL;
+}
+
+static int
+stream_close (ptar_t *tar)
+{
+  int err;
+  struct stream_info *info = tar->stream;
+  if (NULL == info)
+    {
+      return PTAR_EFAILURE;
+    }
+  err = info->writing ? stream_flush (info, NULL, 0) : PTAR_ESUCCESS;
+  free (info->buf);
+  free (info);
+  tar->stream = NULL;
+  return err;
+}
+
+int
+ptar_open_stream (ptar_t *tar, int fd)
+{
+  struct stream_info *info;
+
+  /* Init tar struct and functions */
+  memset (tar, 0, sizeof(*tar));
+  tar->write = stream_write;
+  tar->read = stream_read;
+  tar->seek = stream_seek;
+  tar->close = stream_close;
+  tar->no_readback = 1;
+
+  info = malloc (sizeof(struct stream_info));
+  if (NULL == info)
+    {
+      return PTAR_EOPENFAIL;
+    }
+  info->fd = fd;
+  info->used = 0;
+  info->writing = 0;
+  info->base = 0;
+  info->capacity = PTAR_STREAM_BUFSIZE;
+  info->buf = malloc (info->capacity);
+  if (NULL == info->buf)
+    {
+      PTrace(ERROR_LEVEL, "Failed to allocate stream buffer of %u bytes", info->capacity);
+      free (info);
+      return PTAR_EOPENFAIL;
+    }
+  tar->stream = info;
+  return PTAR_ESUCCESS;
+}
+
+#endif
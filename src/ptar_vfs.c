@@ -0,0 +1,332 @@
+/*
+ * ptar_vfs.c
+ *  Module     : ptar
+ *  Description: Directory tree view of an archive. Nodes live in one array
+ *               and refer to each other by index; a hash table keyed by
+ *               (parent, name) finds a child in one probe, so resolving a
+ *               path costs one lookup per component.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ptar_private.h"
+#include <ptar_vfs.h>
+
+#define VFS_MIN_SLOTS   64
+
+struct ptar_vfs_node
+{
+  /* Offset of the name in vfs->names */
+  unsigned name;
+  unsigned parent;
+  /* Children in archive order; 0 (the root) ends the lists */
+  unsigned first_child;
+  unsigned last_child;
+  unsigned next_sibling;
+  unsigned type;
+  unsigned mode;
+  unsigned owner;
+  unsigned size;
+  unsigned mtime;
+  unsigned offset;
+  int implied;
+};
+
+static uint64_t
+node_hash (unsigned parent, const char *name, unsigned len)
+{
+  return ptar_hash64 (name, len) ^ (parent * 0x9E3779B97F4A7C15ULL);
+}
+
+/* Child `name` (len bytes) of parent, 0 if there is none */
+static unsigned
+vfs_lookup (const ptar_vfs_t *vfs, unsigned parent, const char *name,
+            unsigned len)
+{
+  unsigned i, n;
+  const char *s;
+  if (vfs->nslots == 0)
+    {
+      return 0;
+    }
+  for (i = node_hash (parent, name, len) & (vfs->nslots - 1); vfs->slot[i];
+      i = (i + 1) & (vfs->nslots - 1))
+    {
+      n = vfs->slot[i] - 1;
+      s = vfs->names + vfs->node[n].name;
+      if (vfs->node[n].parent == parent && !strncmp (s, name, len)
+          && s[len] == '\0')
+        {
+          return n;
+        }
+    }
+  return 0;
+}
+
+static void
+slot_insert (ptar_vfs_t *vfs, unsigned n)
+{
+  unsigned i;
+  const char *s = vfs->names + vfs->node[n].name;
+  for (i = node_hash (vfs->node[n].parent, s, strlen (s)) & (vfs->nslots - 1);
+      vfs->slot[i]; i = (i + 1) & (vfs->nslots - 1))
+    ;
+  vfs->slot[i] = n + 1;
+}
+
+/* Make room for one more node. Open addressing: keep the table at most 3/4
+ * full */
+static int
+slots_reserve (ptar_vfs_t *vfs)
+{
+  unsigned i, n;
+  if (4 * (vfs->nnodes + 1) <= 3 * vfs->nslots)
+    {
+      return PTAR_ESUCCESS;
+    }
+  n = vfs->nslots ? 2 * vfs->nslots : VFS_MIN_SLOTS;
+  free (vfs->slot);
+  vfs->slot = calloc (n, sizeof(unsigned));
+  if (NULL == vfs->slot)
+    {
+      vfs->nslots = 0;
+      return PTAR_EFAILURE;
+    }
+  vfs->nslots = n;
+  /* The root is nobody's child */
+  for (i = 1; i < vfs->nnodes; i++)
+    {
+      slot_insert (vfs, i);
+    }
+  return PTAR_ESUCCESS;
+}
+
+/* New implied directory `name` under parent. Returns its index, 0 if out
+ * of memory */
+static unsigned
+vfs_mknode (ptar_vfs_t *vfs, unsigned parent, const char *name, unsigned len)
+{
+  unsigned n = vfs->nnodes;
+  void *p;
+  struct ptar_vfs_node *node;
+
+  if (slots_reserve (vfs))
+    {
+      return 0;
+    }
+  if (n == vfs->capacity)
+    {
+      p = realloc (vfs->node, 2 * (n + 32) * sizeof(struct ptar_vfs_node));
+      if (NULL == p)
+        {
+          return 0;
+        }
+      vfs->node = p;
+      vfs->capacity = 2 * (n + 32);
+    }
+  if (vfs->names_cap - vfs->names_len < len + 1)
+    {
+      p = realloc (vfs->names, 2 * (vfs->names_cap + len + 1));
+      if (NULL == p)
+        {
+          return 0;
+        }
+      vfs->names = p;
+      vfs->names_cap = 2 * (vfs->names_cap + len + 1);
+    }
+  node = &vfs->node[n];
+  memset (node, 0, sizeof(*node));
+  node->name = vfs->names_len;
+  memcpy (vfs->names + vfs->names_len, name, len);
+  vfs->names[vfs->names_len + len] = '\0';
+  vfs->names_len += len + 1;
+  node->parent = parent;
+  node->type = PTAR_TDIR;
+  node->mode = 0755;
+  node->implied = 1;
+  vfs->nnodes++;
+  if (n > 0)
+    {
+      if (vfs->node[parent].first_child)
+        {
+          vfs->node[vfs->node[parent].last_child].next_sibling = n;
+        }
+      else
+        {
+          vfs->node[parent].first_child = n;
+        }
+      vfs->node[parent].last_child = n;
+      slot_insert (vfs, n);
+    }
+  return n;
+}
+
+/* Walk path from the root. With create set, missing components become
+ * implied directories. Returns the node, -1 if it does not exist (or
+ * memory ran out) */
+static int
+vfs_walk (ptar_vfs_t *vfs, const char *path, int create)
+{
+  unsigned n = 0, child, len;
+  while (*path)
+    {
+      for (len = 0; path[len] && path[len] != '/'; len++)
+        ;
+      if (len == 2 && path[0] == '.' && path[1] == '.')
+        {
+          n = vfs->node[n].parent;
+        }
+      else if (len > 0 && !(len == 1 && path[0] == '.'))
+        {
+          child = vfs_lookup (vfs, n, path, len);
+          if (child == 0 && create)
+            {
+              child = vfs_mknode (vfs, n, path, len);
+            }
+          if (child == 0)
+            {
+              return -1;
+            }
+          n = child;
+        }
+      path += len;
+      while (*path == '/')
+        {
+          path++;
+        }
+    }
+  return n;
+}
+
+static void
+vfs_fill (const ptar_vfs_t *vfs, unsigned n, ptar_stat_t *st)
+{
+  const struct ptar_vfs_node *node = &vfs->node[n];
+  st->name = vfs->names + node->name;
+  st->type = node->type;
+  st->mode = node->mode;
+  st->owner = node->owner;
+  st->size = node->size;
+  st->mtime = node->mtime;
+  st->offset = node->offset;
+  st->implied = node->implied;
+}
+
+void
+ptar_vfs_close (ptar_vfs_t *vfs)
+{
+  free (vfs->node);
+  free (vfs->slot);
+  free (vfs->names);
+  memset (vfs, 0, sizeof(*vfs));
+}
+
+int
+ptar_vfs_open (ptar_vfs_t *vfs, ptar_t *tar)
+{
+  int err, n;
+  unsigned pos;
+  ptar_header_t h;
+  struct ptar_vfs_node *node;
+
+  memset (vfs, 0, sizeof(*vfs));
+  vfs->tar = tar;
+  if (vfs_mknode (vfs, 0, "", 0) != 0 || vfs->nnodes != 1)
+    {
+      ptar_vfs_close (vfs);
+      return PTAR_EFAILURE;
+    }
+  err = ptar_rewind (tar);
+  while (err == PTAR_ESUCCESS)
+    {
+      pos = tar->pos;
+      err = ptar_read_header (tar, &h);
+      if (err)
+        {
+          break;
+        }
+      /* Dead members and dictionaries are not files */
+      if (h.type != PTAR_TDEAD && h.type != PTAR_TDICT)
+        {
+          n = vfs_walk (vfs, h.name, 1);
+          if (n < 0)
+            {
+              err = PTAR_EFAILURE;
+              break;
+            }
+          node = &vfs->node[n];
+          node->type = h.type;
+          node->mode = h.mode;
+          node->owner = h.owner;
+          node->size = h.size;
+          node->mtime = h.mtime;
+          node->offset = pos;
+          node->implied = 0;
+        }
+      err = ptar_next (tar);
+    }
+  ptar_rewind (tar);
+  /* Headers end at a null record or at the end of the backend */
+  if (err != PTAR_ENULLRECORD && err != PTAR_EREADFAIL)
+    {
+      ptar_vfs_close (vfs);
+      return err;
+    }
+  return PTAR_ESUCCESS;
+}
+
+int
+ptar_stat (ptar_vfs_t *vfs, const char *path, ptar_stat_t *st)
+{
+  int n = vfs_walk (vfs, path, 0);
+  if (n < 0)
+    {
+      return PTAR_ENOTFOUND;
+    }
+  vfs_fill (vfs, n, st);
+  return PTAR_ESUCCESS;
+}
+
+int
+ptar_opendir (ptar_vfs_t *vfs, const char *path, ptar_dir_t *dir)
+{
+  int n = vfs_walk (vfs, path, 0);
+  if (n < 0)
+    {
+      return PTAR_ENOTFOUND;
+    }
+  if (vfs->node[n].type != PTAR_TDIR)
+    {
+      return PTAR_ENOTDIR;
+    }
+  dir->vfs = vfs;
+  dir->next = vfs->node[n].first_child;
+  return PTAR_ESUCCESS;
+}
+
+int
+ptar_readdir (ptar_dir_t *dir, ptar_stat_t *st)
+{
+  if (dir->next == 0)
+    {
+      return PTAR_ENOTFOUND;
+    }
+  vfs_fill (dir->vfs, dir->next, st);
+  dir->next = dir->vfs->node[dir->next].next_sibling;
+  return PTAR_ESUCCESS;
+}
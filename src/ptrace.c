@@ -0,0 +1,1363 @@
+/*
+ * ptrace.c
+ *  Module     : ptrace
+ *  Description: Log sink. Lines are appended to a write buffer in front of
+ *               one file descriptor that stays open, instead of opening the
+ *               log file for every line.
+ *
+ *               In async mode, each thread formats its lines straight into
+ *               the slots of its own bounded ring (sequence numbered slots,
+ *               registered on the thread's first line), so threads share no
+ *               cache line while logging. A background thread merges the
+ *               rings by timestamp and writes the lines out in batches with
+ *               writev.
+ *
+ *               In binary mode a line is encoded as its call site's id, a
+ *               timestamp and the raw arguments; see ptrace_private.h for
+ *               the layout and ptrace_decode.c for the reader.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "ptrace_private.h"
+
+/* Slots written out with one writev */
+#define ASYNC_BATCH     64
+/* How long the flusher sleeps when the ring is empty */
+#define ASYNC_IDLE_NS   (10 * 1000 * 1000)
+#define CACHE_LINE      64
+
+static const char *const LOG_TAG[] =
+  { "", "ERROR", "INFO", "DEBUG" };
+
+struct ptrace_sink
+{
+  pthread_mutex_t lock;
+  int fd;
+  /* fd was opened by us and is closed on shutdown */
+  int own;
+  int atexit_done;
+  /* Binary log, and its number: sites are described once per log */
+  int binary;
+  unsigned gen;
+  unsigned len;
+  char buf[PTRACE_BUFSIZE];
+};
+
+static struct ptrace_sink sink =
+  { PTHREAD_MUTEX_INITIALIZER, -1, 0, 0, 0, 0, 0, "" };
+
+pthread_mutex_t ptrace_site_lock = PTHREAD_MUTEX_INITIALIZER;
+ptrace_site_t *ptrace_sites;
+static unsigned site_count;
+
+struct ptrace_slot
+{
+  /* Slot i of lap n: i + n * size when free, that + 1 once filled */
+  unsigned long seq;
+  unsigned long long ts;
+  unsigned len;
+  char data[PTRACE_LINE_MAX];
+};
+
+/* One thread's lines. The thread fills slots at enq; the flusher takes them
+ * at deq. Under PTRACE_DROP_OLDEST the thread takes slots too, so taking is
+ * a compare-and-swap */
+struct ptrace_ring
+{
+  unsigned long enq __attribute__((aligned(CACHE_LINE)));
+  unsigned long deq __attribute__((aligned(CACHE_LINE)));
+  unsigned long mask __attribute__((aligned(CACHE_LINE)));
+  /* The thread has exited: freed by the flusher once empty */
+  int orphan;
+  struct ptrace_ring *next;
+  struct ptrace_slot slot[];
+};
+
+struct ptrace_async
+{
+  /* Callers use their ring while this is set */
+  int on;
+  int policy;
+  /* Slots in the ring of a thread that starts logging */
+  unsigned records;
+  int running;
+  int sleeping;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t flushed;
+  unsigned long flush_req;
+  unsigned long flush_done;
+  /* Registered rings, and the key whose destructor orphans them */
+  struct ptrace_ring *rings;
+  pthread_key_t key;
+  unsigned long long written;
+  unsigned long long dropped_newest;
+  unsigned long long dropped_oldest;
+  unsigned long long blocked;
+};
+
+static struct ptrace_async async =
+  { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER,
+      .flushed = PTHREAD_COND_INITIALIZER };
+static pthread_once_t async_key_once = PTHREAD_ONCE_INIT;
+static __thread struct ptrace_ring *my_ring;
+
+static void
+sink_write (int fd, const char *data, unsigned size)
+{
+  ssize_t n;
+  while (size > 0)
+    {
+      n = write (fd, data, size);
+      if (n < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      /* Nowhere to report a failing log file: the lines are lost */
+      if (n <= 0)
+        {
+          return;
+        }
+      data += n;
+      size -= n;
+    }
+}
+
+static void
+sink_writev (int fd, struct iovec *iov, int n)
+{
+  ssize_t done;
+  while (n > 0)
+    {
+      done = writev (fd, iov, n);
+      if (done < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      if (done <= 0)
+        {
+          return;
+        }
+      /* Partial write: skip what went out and retry with the rest */
+      for (; n > 0 && (size_t) done >= iov->iov_len; n--, iov++)
+        {
+          done -= iov->iov_len;
+        }
+      if (n > 0)
+        {
+          iov->iov_base = (char*) iov->iov_base + done;
+          iov->iov_len -= done;
+        }
+    }
+}
+
+/* Called with the lock held */
+static void
+sink_flush (void)
+{
+  if (sink.len > 0 && sink.fd >= 0)
+    {
+      sink_write (sink.fd, sink.buf, sink.len);
+    }
+  sink.len = 0;
+}
+
+/* Called with the lock held */
+static void
+sink_close (void)
+{
+  sink_flush ();
+  if (sink.own)
+    {
+      close (sink.fd);
+    }
+  sink.fd = -1;
+  sink.own = 0;
+}
+
+static void
+sink_exit (void)
+{
+  ptrace_async_stop ();
+  ptrace_flush ();
+}
+
+/* Called with the lock held */
+static int
+sink_open (const char *path, int binary)
+{
+  int fd = STDERR_FILENO;
+  unsigned char hdr[PTRACE_FILE_HDR];
+  uint32_t v[2] =
+    { PTRACE_BOM, 0 };
+
+  if (path)
+    {
+      fd = open (path, O_WRONLY | O_CREAT | O_CLOEXEC
+                 | (binary ? O_TRUNC : O_APPEND), 0644);
+      if (fd < 0)
+        {
+          return -1;
+        }
+    }
+  sink_close ();
+  sink.fd = fd;
+  sink.own = path != NULL;
+  sink.binary = binary;
+  if (binary)
+    {
+      sink.gen++;
+      memcpy (hdr, PTRACE_MAGIC, 8);
+      memcpy (hdr + 8, v, 8);
+      sink_write (fd, (char*) hdr, sizeof(hdr));
+    }
+  if (!sink.atexit_done)
+    {
+      sink.atexit_done = atexit (sink_exit) == 0;
+    }
+  return 0;
+}
+
+/* Open the default sink if none is open. Called with the lock held */
+static void
+sink_ready (void)
+{
+  const char *path;
+  if (sink.fd < 0)
+    {
+      path = getenv ("PTRACE_LOG_FILE");
+      /* Lines still go somewhere if the log file can not be opened */
+      if (sink_open (path && *path ? path : PTRACE_LOG_FILE, 0))
+        {
+          sink_open (NULL, 0);
+        }
+    }
+}
+
+/* Called with the lock held */
+static void
+sink_append (const char *line, unsigned len)
+{
+  sink_ready ();
+  if (len > PTRACE_BUFSIZE - sink.len)
+    {
+      sink_flush ();
+    }
+  memcpy (sink.buf + sink.len, line, len);
+  sink.len += len;
+}
+
+/* Claim the next free slot of the calling thread's ring, NULL if it is full.
+ * Only the owning thread moves enq. The line is timestamped after the claim
+ * is visible, see merge_load */
+static struct ptrace_slot *
+ring_claim (struct ptrace_ring *ring)
+{
+  unsigned long pos = ring->enq;
+  struct ptrace_slot *slot = &ring->slot[pos & ring->mask];
+  if (__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) != pos)
+    {
+      return NULL;
+    }
+  __atomic_store_n (&ring->enq, pos + 1, __ATOMIC_SEQ_CST);
+  return slot;
+}
+
+static void
+ring_publish (struct ptrace_slot *slot)
+{
+  __atomic_store_n (&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Oldest filled slot, left in the ring. NULL if there is none */
+static struct ptrace_slot *
+ring_peek (struct ptrace_ring *ring)
+{
+  unsigned long pos = __atomic_load_n (&ring->deq, __ATOMIC_ACQUIRE);
+  struct ptrace_slot *slot = &ring->slot[pos & ring->mask];
+  return __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) == pos + 1 ? slot : NULL;
+}
+
+/* Take the oldest filled slot, NULL if there is none */
+static struct ptrace_slot *
+ring_take (struct ptrace_ring *ring)
+{
+  long dif;
+  struct ptrace_slot *slot;
+  unsigned long seq, pos = __atomic_load_n (&ring->deq, __ATOMIC_RELAXED);
+  for (;;)
+    {
+      slot = &ring->slot[pos & ring->mask];
+      seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+      dif = (long) (seq - (pos + 1));
+      if (dif == 0)
+        {
+          if (__atomic_compare_exchange_n (&ring->deq, &pos, pos + 1, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+              return slot;
+            }
+        }
+      else if (dif < 0)
+        {
+          return NULL;
+        }
+      else
+        {
+          pos = __atomic_load_n (&ring->deq, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Hand a taken slot back for the next lap */
+static void
+ring_release (struct ptrace_ring *ring, struct ptrace_slot *slot)
+{
+  __atomic_store_n (&slot->seq, slot->seq + ring->mask, __ATOMIC_RELEASE);
+}
+
+static void
+ring_orphan (void *arg)
+{
+  struct ptrace_ring *ring = arg;
+  __atomic_store_n (&ring->orphan, 1, __ATOMIC_RELEASE);
+}
+
+static void
+async_key_init (void)
+{
+  pthread_key_create (&async.key, ring_orphan);
+}
+
+/* The calling thread's ring, registered on first use. NULL if out of
+ * memory */
+static struct ptrace_ring *
+ring_get (void)
+{
+  unsigned long i, n = 1;
+  struct ptrace_ring *ring = my_ring;
+  if (ring)
+    {
+      return ring;
+    }
+  while (n < async.records)
+    {
+      n *= 2;
+    }
+  ring = malloc (sizeof(struct ptrace_ring) + n * sizeof(struct ptrace_slot));
+  if (NULL == ring)
+    {
+      return NULL;
+    }
+  ring->enq = ring->deq = 0;
+  ring->mask = n - 1;
+  ring->orphan = 0;
+  for (i = 0; i < n; i++)
+    {
+      ring->slot[i].seq = i;
+    }
+  pthread_once (&async_key_once, async_key_init);
+  pthread_setspecific (async.key, ring);
+  pthread_mutex_lock (&async.lock);
+  ring->next = async.rings;
+  async.rings = ring;
+  pthread_mutex_unlock (&async.lock);
+  my_ring = ring;
+  return ring;
+}
+
+static void
+async_wake (void)
+{
+  pthread_mutex_lock (&async.lock);
+  pthread_cond_signal (&async.wake);
+  pthread_mutex_unlock (&async.lock);
+}
+
+/* Min-heap of rings keyed by the timestamp of their oldest line */
+struct merge
+{
+  struct ptrace_ring **ring;
+  unsigned long long *ts;
+  unsigned n;
+  unsigned cap;
+};
+
+static void
+merge_push (struct merge *m, struct ptrace_ring *ring, unsigned long long ts)
+{
+  unsigned i = m->n++, up;
+  for (; i > 0 && m->ts[up = (i - 1) / 2] > ts; i = up)
+    {
+      m->ring[i] = m->ring[up];
+      m->ts[i] = m->ts[up];
+    }
+  m->ring[i] = ring;
+  m->ts[i] = ts;
+}
+
+static struct ptrace_ring *
+merge_pop (struct merge *m)
+{
+  unsigned i = 0, c;
+  struct ptrace_ring *top = m->ring[0], *last = m->ring[--m->n];
+  unsigned long long ts = m->ts[m->n];
+  while ((c = 2 * i + 1) < m->n)
+    {
+      if (c + 1 < m->n && m->ts[c + 1] < m->ts[c])
+        {
+          c++;
+        }
+      if (m->ts[c] >= ts)
+        {
+          break;
+        }
+      m->ring[i] = m->ring[c];
+      m->ts[i] = m->ts[c];
+      i = c;
+    }
+  m->ring[i] = last;
+  m->ts[i] = ts;
+  return top;
+}
+
+/* Load the rings holding lines into the heap, freeing the rings of exited
+ * threads once they are empty. Returns -1 if out of memory.
+ *
+ * Lines stamped up to *t0 are all in the heap once this returns: a thread
+ * stamps its line after claiming the slot, so a claim not seen here carries
+ * a later stamp, and claims seen here are waited for until published */
+static int
+merge_load (struct merge *m, unsigned long long *t0)
+{
+  unsigned n = 0;
+  void *p;
+  unsigned long enq;
+  struct ptrace_ring *ring, **link;
+  struct ptrace_slot *slot;
+
+  pthread_mutex_lock (&async.lock);
+  for (ring = async.rings; ring; ring = ring->next)
+    {
+      n++;
+    }
+  if (n > m->cap)
+    {
+      p = realloc (m->ring, n * sizeof(*m->ring));
+      m->ring = p ? p : m->ring;
+      p = p ? realloc (m->ts, n * sizeof(*m->ts)) : NULL;
+      m->ts = p ? p : m->ts;
+      if (NULL == p)
+        {
+          pthread_mutex_unlock (&async.lock);
+          return -1;
+        }
+      m->cap = n;
+    }
+  m->n = 0;
+  *t0 = ptrace_clock_ns ();
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  for (link = &async.rings; (ring = *link);)
+    {
+      enq = __atomic_load_n (&ring->enq, __ATOMIC_SEQ_CST);
+      slot = &ring->slot[(enq - 1) & ring->mask];
+      while (enq && __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) == enq - 1)
+        {
+          sched_yield ();
+        }
+      slot = ring_peek (ring);
+      if (slot)
+        {
+          merge_push (m, ring, slot->ts);
+        }
+      else if (__atomic_load_n (&ring->orphan, __ATOMIC_ACQUIRE))
+        {
+          *link = ring->next;
+          free (ring);
+          continue;
+        }
+      link = &ring->next;
+    }
+  pthread_mutex_unlock (&async.lock);
+  return 0;
+}
+
+/* Write out the lines in all rings, oldest first; with last, the lines
+ * stamped after the watermark too: nothing earlier can come any more.
+ * Returns the number of lines written */
+static unsigned long
+async_drain (struct merge *m, int last)
+{
+  int i, n;
+  unsigned long total = 0;
+  unsigned long long t0;
+  struct iovec iov[ASYNC_BATCH];
+  struct ptrace_slot *batch[ASYNC_BATCH], *slot;
+  struct ptrace_ring *owner[ASYNC_BATCH], *ring;
+
+  do
+    {
+      if (merge_load (m, &t0))
+        {
+          break;
+        }
+      /* Later lines wait for the next round: an earlier one may still come.
+       * Lines stamped t0 go now, so a flush sees them with a coarse clock;
+       * any line still to come is stamped t0 or later */
+      for (n = 0; n < ASYNC_BATCH && m->n > 0 && (last || m->ts[0] <= t0);)
+        {
+          ring = merge_pop (m);
+          slot = ring_take (ring);
+          if (slot)
+            {
+              owner[n] = ring;
+              batch[n] = slot;
+              iov[n].iov_base = slot->data;
+              iov[n++].iov_len = slot->len;
+            }
+          /* The ring's next line competes again */
+          slot = ring_peek (ring);
+          if (slot)
+            {
+              merge_push (m, ring, slot->ts);
+            }
+        }
+      if (n > 0)
+        {
+          pthread_mutex_lock (&sink.lock);
+          sink_ready ();
+          /* Lines buffered before async mode go first */
+          sink_flush ();
+          sink_writev (sink.fd, iov, n);
+          pthread_mutex_unlock (&sink.lock);
+          for (i = 0; i < n; i++)
+            {
+              ring_release (owner[i], batch[i]);
+            }
+          total += n;
+        }
+    }
+  while (n == ASYNC_BATCH);
+  __atomic_add_fetch (&async.written, total, __ATOMIC_RELAXED);
+  return total;
+}
+
+static void *
+async_main (void *arg)
+{
+  int stop = 0;
+  unsigned long target, n;
+  struct timespec ts;
+  struct merge m;
+  (void) arg;
+
+  memset (&m, 0, sizeof(m));
+  while (!stop)
+    {
+      pthread_mutex_lock (&async.lock);
+      target = async.flush_req;
+      pthread_mutex_unlock (&async.lock);
+
+      n = async_drain (&m, 0);
+
+      pthread_mutex_lock (&async.lock);
+      if (async.flush_done != target)
+        {
+          async.flush_done = target;
+          pthread_cond_broadcast (&async.flushed);
+        }
+      if (!async.running)
+        {
+          stop = 1;
+        }
+      else if (n == 0 && async.flush_req == target)
+        {
+          clock_gettime (CLOCK_REALTIME, &ts);
+          ts.tv_nsec += ASYNC_IDLE_NS;
+          if (ts.tv_nsec >= 1000000000)
+            {
+              ts.tv_sec++;
+              ts.tv_nsec -= 1000000000;
+            }
+          __atomic_store_n (&async.sleeping, 1, __ATOMIC_RELAXED);
+          pthread_cond_timedwait (&async.wake, &async.lock, &ts);
+          __atomic_store_n (&async.sleeping, 0, __ATOMIC_RELAXED);
+        }
+      pthread_mutex_unlock (&async.lock);
+    }
+  /* Lines logged while stopping */
+  async_drain (&m, 1);
+  free (m.ring);
+  free (m.ts);
+  return NULL;
+}
+
+int
+ptrace_async_start (unsigned records, int policy)
+{
+  if (__atomic_load_n (&async.on, __ATOMIC_ACQUIRE))
+    {
+      return 0;
+    }
+  /* Rings are kept after ptrace_async_stop: their thread may still be
+   * writing into them. A thread keeps its ring size on restart */
+  async.records = records ? records : PTRACE_RING_SIZE;
+  async.policy = policy;
+  async.running = 1;
+  if (pthread_create (&async.thread, NULL, async_main, NULL))
+    {
+      async.running = 0;
+      return -1;
+    }
+  __atomic_store_n (&async.on, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void
+ptrace_async_stop (void)
+{
+  if (!__atomic_load_n (&async.on, __ATOMIC_ACQUIRE))
+    {
+      return;
+    }
+  __atomic_store_n (&async.on, 0, __ATOMIC_RELEASE);
+  pthread_mutex_lock (&async.lock);
+  async.running = 0;
+  pthread_cond_signal (&async.wake);
+  pthread_mutex_unlock (&async.lock);
+  pthread_join (async.thread, NULL);
+}
+
+void
+ptrace_stats (ptrace_stats_t *st)
+{
+  st->written = __atomic_load_n (&async.written, __ATOMIC_RELAXED);
+  st->dropped_newest = __atomic_load_n (&async.dropped_newest, __ATOMIC_RELAXED);
+  st->dropped_oldest = __atomic_load_n (&async.dropped_oldest, __ATOMIC_RELAXED);
+  st->blocked = __atomic_load_n (&async.blocked, __ATOMIC_RELAXED);
+}
+
+int
+ptrace_init (const char *path)
+{
+  int err;
+  pthread_mutex_lock (&sink.lock);
+  err = sink_open (path, 0);
+  pthread_mutex_unlock (&sink.lock);
+  return err;
+}
+
+int
+ptrace_init_binary (const char *path)
+{
+  int err;
+  pthread_mutex_lock (&sink.lock);
+  err = sink_open (path, 1);
+  pthread_mutex_unlock (&sink.lock);
+  return err;
+}
+
+const char *
+ptrace_spec_parse (const char *p, int *stars, int *type)
+{
+  int l = 0, big = 0;
+
+  *stars = 0;
+  *type = PTRACE_ARG_NONE;
+  if (*p == '%')
+    {
+      return p + 1;
+    }
+  p += strspn (p, "-+ #0'");
+  if (*p == '*')
+    {
+      ++*stars;
+      p++;
+    }
+  p += strspn (p, "0123456789");
+  if (*p == '.')
+    {
+      if (*++p == '*')
+        {
+          ++*stars;
+          p++;
+        }
+      p += strspn (p, "0123456789");
+    }
+  for (;; p++)
+    {
+      if (*p == 'l')
+        {
+          l++;
+        }
+      /* size_t, ptrdiff_t: long; intmax_t: long long */
+      else if (*p == 'z' || *p == 't')
+        {
+          l = 1;
+        }
+      else if (*p == 'j' || *p == 'q')
+        {
+          l = 2;
+        }
+      else if (*p == 'L')
+        {
+          big = 1;
+        }
+      else if (*p != 'h')
+        {
+          break;
+        }
+    }
+  switch (*p)
+    {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+      *type = l == 0 ? PTRACE_ARG_INT : l == 1 ? PTRACE_ARG_LONG
+          : PTRACE_ARG_LLONG;
+      break;
+    case 'c':
+      *type = l ? PTRACE_ARG_BAD : PTRACE_ARG_INT;
+      break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      *type = big ? PTRACE_ARG_LDOUBLE : PTRACE_ARG_DOUBLE;
+      break;
+    case 's':
+      *type = l ? PTRACE_ARG_BAD : PTRACE_ARG_STR;
+      break;
+    case 'p':
+      *type = PTRACE_ARG_PTR;
+      break;
+    default:
+      /* %n, wide characters, a cut conversion */
+      *type = PTRACE_ARG_BAD;
+      return *p ? p + 1 : p;
+    }
+  return p + 1;
+}
+
+/* " | LEVEL | file | func:line | ". Returns its length, at most cap - 1 */
+static unsigned
+prefix_tail (char *buf, unsigned cap, int level, const char *file,
+             const char *func, int line)
+{
+  int len = snprintf (buf, cap, " | %-7s | %-15s | %s:%d | ",
+                      LOG_TAG[level & 3], file, func, line);
+  return len < (int) cap - 1 ? (unsigned) len : cap - 1;
+}
+
+#define RATE_FMT "%s:%d: %lu lines dropped by the rate limit"
+#define FOLD_FMT "%s:%d: last message repeated %lu times"
+
+void
+ptrace_site_register (ptrace_site_t *site)
+{
+  int stars, type;
+  unsigned n = 0;
+  const char *p;
+  char *q, tail[PTRACE_LINE_MAX / 2];
+
+  pthread_mutex_lock (&ptrace_site_lock);
+  if (site->id == 0)
+    {
+      if (NULL == site->base)
+        {
+          p = strrchr (site->file, '/');
+          site->base = p ? p + 1 : site->file;
+        }
+      /* Sites of other front-ends are text already */
+      for (p = site->nargs == PTRACE_SITE_TEXT ? "" : site->fmt;
+          (p = strchr (p, '%'));)
+        {
+          p = ptrace_spec_parse (p + 1, &stars, &type);
+          if (type == PTRACE_ARG_NONE)
+            {
+              continue;
+            }
+          /* Lines of this site are formatted on the calling thread */
+          if (type == PTRACE_ARG_BAD || n + stars + 1 > PTRACE_MAX_ARGS)
+            {
+              n = PTRACE_ARGS_TEXT;
+              break;
+            }
+          while (stars--)
+            {
+              site->types[n++] = PTRACE_ARG_INT;
+            }
+          site->types[n++] = type;
+        }
+      site->nargs = site->nargs == PTRACE_SITE_TEXT ? PTRACE_SITE_TEXT : n;
+      n = prefix_tail (tail, sizeof(tail), site->level, site->base,
+                       site->func, site->line);
+      if ((site->tail = q = malloc (n + 1)))
+        {
+          memcpy (q, tail, n + 1);
+          site->tail_len = n;
+        }
+      site->next = ptrace_sites;
+      /* Read without the lock by sites_report */
+      __atomic_store_n (&ptrace_sites, site, __ATOMIC_RELEASE);
+      __atomic_store_n (&site->id, ++site_count, __ATOMIC_RELEASE);
+    }
+  pthread_mutex_unlock (&ptrace_site_lock);
+}
+
+/* Write what site held back: lines dropped by PTraceRate, repeats folded by
+ * PTraceFold */
+static void
+site_report (ptrace_site_t *site, int rate)
+{
+  /* Sites of the report lines, one per level */
+  static ptrace_site_t rate_site[] =
+    { PTRACE_SITE_INIT(NO_LOG, RATE_FMT, 0),
+        PTRACE_SITE_INIT(ERROR_LEVEL, RATE_FMT, 0),
+        PTRACE_SITE_INIT(INFO_LEVEL, RATE_FMT, 0),
+        PTRACE_SITE_INIT(DEBUG_LEVEL, RATE_FMT, 0) };
+  static ptrace_site_t fold_site[] =
+    { PTRACE_SITE_INIT(NO_LOG, FOLD_FMT, 0),
+        PTRACE_SITE_INIT(ERROR_LEVEL, FOLD_FMT, 0),
+        PTRACE_SITE_INIT(INFO_LEVEL, FOLD_FMT, 0),
+        PTRACE_SITE_INIT(DEBUG_LEVEL, FOLD_FMT, 0) };
+  unsigned long n;
+  int level = site->level & 3;
+
+  if (rate)
+    {
+      n = __atomic_exchange_n (&site->suppressed, 0, __ATOMIC_RELAXED);
+      if (n)
+        {
+          ptrace_log (&rate_site[level], RATE_FMT, site->base, site->line, n);
+        }
+    }
+  else
+    {
+      n = __atomic_exchange_n (&site->repeats, 0, __ATOMIC_RELAXED);
+      if (n)
+        {
+          ptrace_log (&fold_site[level], FOLD_FMT, site->base, site->line, n);
+        }
+    }
+}
+
+/* Report the counts held back by every site, so they are not lost when the
+ * line that would carry them never comes */
+static void
+sites_report (void)
+{
+  ptrace_site_t *site;
+
+  /* Sites are only ever added, at the head */
+  for (site = __atomic_load_n (&ptrace_sites, __ATOMIC_ACQUIRE); site;
+      site = site->next)
+    {
+      site_report (site, 1);
+      site_report (site, 0);
+    }
+}
+
+void
+ptrace_shutdown (void)
+{
+  sites_report ();
+  ptrace_async_stop ();
+  pthread_mutex_lock (&sink.lock);
+  sink_close ();
+  pthread_mutex_unlock (&sink.lock);
+}
+
+void
+ptrace_flush (void)
+{
+  unsigned long req;
+
+  sites_report ();
+  if (__atomic_load_n (&async.on, __ATOMIC_ACQUIRE))
+    {
+      /* The flusher drains the ring, then reports back */
+      pthread_mutex_lock (&async.lock);
+      req = ++async.flush_req;
+      pthread_cond_signal (&async.wake);
+      while (async.running && async.flush_done < req)
+        {
+          pthread_cond_wait (&async.flushed, &async.lock);
+        }
+      pthread_mutex_unlock (&async.lock);
+    }
+  pthread_mutex_lock (&sink.lock);
+  sink_flush ();
+  pthread_mutex_unlock (&sink.lock);
+}
+
+unsigned
+ptrace_prefix (char *buf, unsigned cap, unsigned long long ts, int level,
+               const char *file, const char *func, int line)
+{
+  unsigned len = ptrace_stamp (buf, ts);
+  return len + prefix_tail (buf + len, cap - len, level, file, func, line);
+}
+
+/* The prefix of a text line of site. Returns its length */
+static unsigned
+line_prefix (char *buf, unsigned cap, unsigned long long ts,
+             const ptrace_site_t *site)
+{
+  unsigned len;
+
+  /* Only the stamp changes from line to line */
+  if (NULL == site->tail)
+    {
+      return ptrace_prefix (buf, cap, ts, site->level, site->base, site->func,
+                            site->line);
+    }
+  len = ptrace_stamp (buf, ts);
+  memcpy (buf + len, site->tail, site->tail_len);
+  return len + site->tail_len;
+}
+
+/* Format one line into buf. Returns its length, newline included */
+static unsigned
+format_line (char *buf, unsigned cap, unsigned long long ts,
+             const ptrace_site_t *site, const char *fmt, va_list ap)
+{
+  int n;
+  unsigned len = line_prefix (buf, cap, ts, site);
+
+  n = vsnprintf (buf + len, cap - len, fmt, ap);
+  if (n > 0)
+    {
+      len += (unsigned) n < cap - len ? (unsigned) n : cap - len - 1;
+    }
+  /* Room is left for the newline, even on a cut line */
+  buf[len++] = '\n';
+  return len;
+}
+
+static void
+rec_header (unsigned char *rec, unsigned len, int kind)
+{
+  uint16_t n = len;
+  memcpy (rec, &n, 2);
+  rec[2] = kind;
+  rec[3] = 0;
+}
+
+/* Describe site in a SITE record. Returns its length */
+static unsigned
+encode_site (unsigned char *rec, unsigned cap, const ptrace_site_t *site)
+{
+  unsigned i, n, len = PTRACE_REC_HDR;
+  uint32_t v[2];
+  const char *str[3];
+
+  v[0] = site->id;
+  v[1] = site->line;
+  memcpy (rec + len, v, 8);
+  len += 8;
+  rec[len++] = site->level;
+  rec[len++] = site->nargs;
+  n = site->nargs == PTRACE_ARGS_TEXT ? 0 : site->nargs;
+  memcpy (rec + len, site->types, n);
+  len += n;
+  str[0] = site->base;
+  str[1] = site->func;
+  str[2] = site->fmt;
+  for (i = 0; i < 3; i++)
+    {
+      /* Cut to fit, the format last */
+      n = strlen (str[i]);
+      n = n < cap - len - (3 - i) ? n : cap - len - (3 - i);
+      memcpy (rec + len, str[i], n);
+      len += n;
+      rec[len++] = '\0';
+    }
+  rec_header (rec, len, PTRACE_REC_SITE);
+  return len;
+}
+
+/* Encode a line of site in a LOG record. Returns its length */
+static unsigned
+encode_log (unsigned char *rec, unsigned cap, const ptrace_site_t *site,
+            unsigned long long ts, const char *fmt, va_list ap)
+{
+  int i, nargs = site->nargs;
+  unsigned len = PTRACE_REC_HDR, room;
+  uint32_t id = site->id;
+  uint16_t n;
+  int32_t i32;
+  int64_t i64;
+  uint64_t u64;
+  double d;
+  const char *str;
+
+  memcpy (rec + len, &id, 4);
+  memcpy (rec + len + 4, &ts, 8);
+  len += 12;
+  if (nargs == PTRACE_ARGS_TEXT)
+    {
+      i32 = vsnprintf ((char*) rec + len + 2, cap - len - 2, fmt, ap);
+      n = i32 < 0 ? 0 :
+          (unsigned) i32 < cap - len - 2 ? (unsigned) i32 : cap - len - 3;
+      memcpy (rec + len, &n, 2);
+      len += 2 + n;
+    }
+  for (i = 0; nargs != PTRACE_ARGS_TEXT && i < nargs; i++)
+    {
+      switch (site->types[i])
+        {
+        case PTRACE_ARG_INT:
+          i32 = va_arg(ap, int);
+          memcpy (rec + len, &i32, 4);
+          len += 4;
+          break;
+        case PTRACE_ARG_LONG:
+          i64 = va_arg(ap, long);
+          memcpy (rec + len, &i64, 8);
+          len += 8;
+          break;
+        case PTRACE_ARG_LLONG:
+          i64 = va_arg(ap, long long);
+          memcpy (rec + len, &i64, 8);
+          len += 8;
+          break;
+        case PTRACE_ARG_DOUBLE:
+          d = va_arg(ap, double);
+          memcpy (rec + len, &d, 8);
+          len += 8;
+          break;
+        case PTRACE_ARG_LDOUBLE:
+          d = va_arg(ap, long double);
+          memcpy (rec + len, &d, 8);
+          len += 8;
+          break;
+        case PTRACE_ARG_PTR:
+          u64 = (uintptr_t) va_arg(ap, void*);
+          memcpy (rec + len, &u64, 8);
+          len += 8;
+          break;
+        case PTRACE_ARG_STR:
+          str = va_arg(ap, const char*);
+          str = str ? str : "(null)";
+          /* Cut to leave room for the arguments after it, 8 bytes at most
+           * each, and the length fields */
+          room = cap - len - 2 - 10 * (nargs - i - 1);
+          n = strnlen (str, room);
+          memcpy (rec + len, &n, 2);
+          memcpy (rec + len + 2, str, n);
+          len += 2 + n;
+          break;
+        }
+    }
+  rec_header (rec, len, PTRACE_REC_LOG);
+  return len;
+}
+
+/* Claim a slot of ring as the overflow policy says. NULL: the line is
+ * dropped */
+static struct ptrace_slot *
+async_claim (struct ptrace_ring *ring)
+{
+  int waited = 0;
+  struct ptrace_slot *slot;
+  unsigned long fill;
+
+  while (NULL == (slot = ring_claim (ring)))
+    {
+      if (async.policy == PTRACE_DROP_OLDEST && (slot = ring_take (ring)))
+        {
+          ring_release (ring, slot);
+          __atomic_add_fetch (&async.dropped_oldest, 1, __ATOMIC_RELAXED);
+          continue;
+        }
+      /* Nothing to drop while the flusher holds every slot: drop this one.
+       * Nobody to wait for once async mode is stopped */
+      if (async.policy != PTRACE_BLOCK
+          || !__atomic_load_n (&async.on, __ATOMIC_RELAXED))
+        {
+          __atomic_add_fetch (&async.dropped_newest, 1, __ATOMIC_RELAXED);
+          return NULL;
+        }
+      if (!waited++)
+        {
+          __atomic_add_fetch (&async.blocked, 1, __ATOMIC_RELAXED);
+        }
+      async_wake ();
+      sched_yield ();
+    }
+  /* Wake a sleeping flusher once the ring is half full */
+  fill = ring->enq - __atomic_load_n (&ring->deq, __ATOMIC_RELAXED);
+  if (fill > ring->mask / 2 && __atomic_load_n (&async.sleeping, __ATOMIC_RELAXED))
+    {
+      async_wake ();
+    }
+  return slot;
+}
+
+/* Describe site in the binary log gen. The record goes straight to the
+ * sink, not through a ring: there it could be dropped while lines of the
+ * site are kept. The decoder reads sites from anywhere in the log, so the
+ * record need not come ahead of the lines */
+static void
+sink_describe (ptrace_site_t *site, unsigned gen)
+{
+  unsigned char def[PTRACE_LINE_MAX];
+  unsigned len = encode_site (def, sizeof(def), site);
+
+  pthread_mutex_lock (&sink.lock);
+  if (sink.binary && gen == sink.gen)
+    {
+      sink_append ((char*) def, len);
+    }
+  pthread_mutex_unlock (&sink.lock);
+  site->gen = gen;
+}
+
+static void
+log_va (ptrace_site_t *site, const char *fmt, va_list ap)
+{
+  unsigned len, n = 0;
+  int binary = __atomic_load_n (&sink.binary, __ATOMIC_RELAXED);
+  unsigned gen = __atomic_load_n (&sink.gen, __ATOMIC_RELAXED);
+  unsigned char buf[PTRACE_LINE_MAX], def[PTRACE_LINE_MAX];
+  unsigned long long ts;
+  struct ptrace_slot *slot;
+  struct ptrace_ring *ring;
+
+  if (!__atomic_load_n (&site->id, __ATOMIC_ACQUIRE))
+    {
+      ptrace_site_register (site);
+    }
+  if (__atomic_load_n (&async.on, __ATOMIC_ACQUIRE) && (ring = ring_get ()))
+    {
+      if (binary && site->gen != gen)
+        {
+          sink_describe (site, gen);
+        }
+      slot = async_claim (ring);
+      if (slot)
+        {
+          slot->ts = ts = ptrace_clock_ns ();
+          slot->len = binary ?
+              encode_log ((unsigned char*) slot->data, sizeof(slot->data), site,
+                          ts, fmt, ap) :
+              format_line (slot->data, sizeof(slot->data), ts, site, fmt, ap);
+          ring_publish (slot);
+        }
+    }
+  else
+    {
+      ts = ptrace_clock_ns ();
+      len = binary ? encode_log (buf, sizeof(buf), site, ts, fmt, ap) :
+          format_line ((char*) buf, sizeof(buf), ts, site, fmt, ap);
+      if (binary && site->gen != gen)
+        {
+          n = encode_site (def, sizeof(def), site);
+          site->gen = gen;
+        }
+      pthread_mutex_lock (&sink.lock);
+      /* Written to a sink opened in between, the line would not decode */
+      if (binary == sink.binary && (!binary || gen == sink.gen))
+        {
+          sink_append ((char*) def, n);
+          sink_append ((char*) buf, len);
+        }
+      pthread_mutex_unlock (&sink.lock);
+    }
+}
+
+void
+ptrace_log (ptrace_site_t *site, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  log_va (site, fmt, ap);
+  va_end(ap);
+}
+
+int
+ptrace_rate (ptrace_site_t *site, unsigned per_sec, unsigned burst)
+{
+  unsigned long long now = ptrace_clock_ns (), full, next;
+  unsigned long long step = 1000000000ULL / (per_sec ? per_sec : 1);
+  /* How far ahead of now the bucket may run: burst lines */
+  unsigned long long slack = step * (burst ? burst - 1 : 0);
+
+  /* GCRA: the bucket is one time stamp, moved on by step per line */
+  full = __atomic_load_n (&site->full_at, __ATOMIC_RELAXED);
+  do
+    {
+      next = full > now ? full : now;
+      if (next - now > slack)
+        {
+          __atomic_add_fetch (&site->suppressed, 1, __ATOMIC_RELAXED);
+          return 0;
+        }
+      next += step;
+    }
+  while (!__atomic_compare_exchange_n (&site->full_at, &full, next, 1,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  if (__atomic_load_n (&site->suppressed, __ATOMIC_RELAXED))
+    {
+      site_report (site, 1);
+    }
+  return 1;
+}
+
+void
+ptrace_log_fold (ptrace_site_t *site, const char *fmt, ...)
+{
+  int n;
+  unsigned long long hash = 14695981039346656037ULL;
+  unsigned char text[PTRACE_LINE_MAX], *p;
+  va_list ap;
+
+  va_start(ap, fmt);
+  n = vsnprintf ((char*) text, sizeof(text), fmt, ap);
+  va_end(ap);
+  n = n < 0 ? 0 : n < (int) sizeof(text) ? n : (int) sizeof(text) - 1;
+  /* FNV-1a of the text */
+  for (p = text; p < text + n; p++)
+    {
+      hash = (hash ^ *p) * 1099511628211ULL;
+    }
+  if (__atomic_exchange_n (&site->last_hash, hash, __ATOMIC_RELAXED) == hash)
+    {
+      __atomic_add_fetch (&site->repeats, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  site_report (site, 0);
+  va_start(ap, fmt);
+  log_va (site, fmt, ap);
+  va_end(ap);
+}
+
+void
+ptrace_line_begin (ptrace_site_t *site, ptrace_line_t *line)
+{
+  uint32_t id;
+  unsigned long long ts;
+  struct ptrace_ring *ring;
+  struct ptrace_slot *slot = NULL;
+
+  if (!__atomic_load_n (&site->id, __ATOMIC_ACQUIRE))
+    {
+      ptrace_site_register (site);
+    }
+  line->site = site;
+  line->binary = __atomic_load_n (&sink.binary, __ATOMIC_RELAXED);
+  line->gen = __atomic_load_n (&sink.gen, __ATOMIC_RELAXED);
+  line->async = __atomic_load_n (&async.on, __ATOMIC_ACQUIRE)
+      && (ring = ring_get ());
+  line->buf = line->local;
+  if (line->async)
+    {
+      if (line->binary && site->gen != line->gen)
+        {
+          sink_describe (site, line->gen);
+        }
+      /* A dropped line is written to local, then thrown away */
+      slot = async_claim (ring);
+      line->buf = slot ? slot->data : line->local;
+    }
+  line->slot = slot;
+  ts = ptrace_clock_ns ();
+  if (slot)
+    {
+      slot->ts = ts;
+    }
+  if (line->binary)
+    {
+      /* A LOG record of a text site: id, stamp, then u16 length and text */
+      id = site->id;
+      memcpy (line->buf + PTRACE_REC_HDR, &id, 4);
+      memcpy (line->buf + PTRACE_REC_HDR + 4, &ts, 8);
+      line->head = PTRACE_REC_HDR + 14;
+    }
+  else
+    {
+      line->head = line_prefix (line->buf, PTRACE_LINE_MAX, ts, site);
+    }
+  line->text = line->buf + line->head;
+  line->len = 0;
+  /* Room for the newline */
+  line->cap = PTRACE_LINE_MAX - line->head - 1;
+}
+
+void
+ptrace_line_end (ptrace_line_t *line)
+{
+  uint16_t n;
+  unsigned len, def_len = 0;
+  unsigned char def[PTRACE_LINE_MAX];
+  struct ptrace_slot *slot = line->slot;
+
+  line->len = line->len < line->cap ? line->len : line->cap;
+  len = line->head + line->len;
+  if (line->binary)
+    {
+      n = line->len;
+      memcpy (line->buf + PTRACE_REC_HDR + 12, &n, 2);
+      rec_header ((unsigned char*) line->buf, len, PTRACE_REC_LOG);
+    }
+  else
+    {
+      line->buf[len++] = '\n';
+    }
+  if (line->async)
+    {
+      if (slot)
+        {
+          slot->len = len;
+          ring_publish (slot);
+        }
+      return;
+    }
+  if (line->binary && line->site->gen != line->gen)
+    {
+      def_len = encode_site (def, sizeof(def), line->site);
+      line->site->gen = line->gen;
+    }
+  pthread_mutex_lock (&sink.lock);
+  if (line->binary == sink.binary && (!line->binary
+      || line->gen == sink.gen))
+    {
+      sink_append ((char*) def, def_len);
+      sink_append (line->buf, len);
+    }
+  pthread_mutex_unlock (&sink.lock);
+}
@@ -0,0 +1,228 @@
+/*
+ * ptrace_clock.c
+ *  Module     : ptrace
+ *  Description: Line timestamps. A stamp is nanoseconds since the epoch read
+ *               from the chosen source: CLOCK_MONOTONIC (the default),
+ *               CLOCK_MONOTONIC_COARSE (cheapest, tick resolution) or the
+ *               TSC, scaled by a factor calibrated against CLOCK_MONOTONIC,
+ *               each offset to the wall clock.
+ *
+ *               Each thread compares the wall clock with the monotonic one
+ *               again once a second. A step forward of the wall clock (NTP's
+ *               first sync) moves the offset with it; a step back is not
+ *               followed, so stamps never go back and lines merged by stamp
+ *               keep their order.
+ *
+ *               The date and time of a stamp are rendered once per second
+ *               per thread: each thread keeps the last second it formatted,
+ *               so localtime_r and strftime run once a second, not per line.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#include "ptrace_private.h"
+
+/* How long the TSC is calibrated against CLOCK_MONOTONIC */
+#define TSC_CALIBRATE_NS (20 * 1000 * 1000)
+
+static struct
+{
+  int source;
+  /* Wall clock minus CLOCK_MONOTONIC */
+  long long offset;
+  /* TSC source: CLOCK_MONOTONIC = ns0 + ((tsc - tsc0) * mult >> 32) */
+  unsigned long long tsc0;
+  unsigned long long ns0;
+  unsigned long long mult;
+} clk;
+
+static pthread_mutex_t clk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* When this thread compares the clocks again, CLOCK_MONOTONIC ns */
+static __thread unsigned long long next_follow;
+
+/* Date and time of the second last rendered by this thread */
+static __thread struct
+{
+  long long sec;
+  char text[24];
+} stamp_cache = { -1, "" };
+
+static unsigned long long
+read_ns (clockid_t id)
+{
+  struct timespec ts;
+  clock_gettime (id, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static long long
+wall_offset (void)
+{
+  return (long long) (read_ns (CLOCK_REALTIME) - read_ns (CLOCK_MONOTONIC));
+}
+
+static void
+clock_anchor (void)
+{
+  __atomic_store_n (&clk.offset, wall_offset (), __ATOMIC_RELAXED);
+}
+
+/* Follow a step forward of the wall clock, at most once a second per
+ * thread. mono is the CLOCK_MONOTONIC time of the stamp being taken */
+static long long
+clock_follow (unsigned long long mono)
+{
+  long long off, old = __atomic_load_n (&clk.offset, __ATOMIC_RELAXED);
+
+  if (mono < next_follow)
+    {
+      return old;
+    }
+  next_follow = mono + 1000000000;
+  off = wall_offset ();
+  while (off > old
+      && !__atomic_compare_exchange_n (&clk.offset, &old, off, 1,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  return off > old ? off : old;
+}
+
+static void __attribute__((constructor))
+clock_setup (void)
+{
+  clock_anchor ();
+}
+
+#if defined(__x86_64__)
+/* Calibrate the TSC. Returns -1 if it is not invariant: its rate then
+ * follows the core's frequency */
+static int
+tsc_calibrate (void)
+{
+  unsigned a, b, c, d;
+  unsigned long long t0, t1, n0, n1;
+
+  if (!__get_cpuid (0x80000007, &a, &b, &c, &d) || !(d & (1u << 8)))
+    {
+      return -1;
+    }
+  n0 = read_ns (CLOCK_MONOTONIC);
+  t0 = __rdtsc ();
+  do
+    {
+      n1 = read_ns (CLOCK_MONOTONIC);
+      t1 = __rdtsc ();
+    }
+  while (n1 - n0 < TSC_CALIBRATE_NS);
+  clk.mult = (unsigned long long) (((unsigned __int128) (n1 - n0) << 32)
+      / (t1 - t0));
+  clk.tsc0 = t1;
+  clk.ns0 = n1;
+  return 0;
+}
+#endif
+
+int
+ptrace_clock (int source)
+{
+  int err = 0;
+
+  pthread_mutex_lock (&clk_lock);
+  clock_anchor ();
+  switch (source)
+    {
+    case PTRACE_CLOCK_MONOTONIC:
+    case PTRACE_CLOCK_COARSE:
+      break;
+#if defined(__x86_64__)
+    case PTRACE_CLOCK_TSC:
+      err = tsc_calibrate ();
+      break;
+#endif
+    default:
+      err = -1;
+      break;
+    }
+  if (err)
+    {
+      errno = ENOTSUP;
+    }
+  else
+    {
+      __atomic_store_n (&clk.source, source, __ATOMIC_RELEASE);
+    }
+  pthread_mutex_unlock (&clk_lock);
+  return err;
+}
+
+unsigned long long
+ptrace_clock_ns (void)
+{
+  unsigned long long mono;
+
+  switch (__atomic_load_n (&clk.source, __ATOMIC_ACQUIRE))
+    {
+    case PTRACE_CLOCK_COARSE:
+      mono = read_ns (CLOCK_MONOTONIC_COARSE);
+      break;
+#if defined(__x86_64__)
+    case PTRACE_CLOCK_TSC:
+      mono = clk.ns0 + (unsigned long long)
+          (((unsigned __int128) (__rdtsc () - clk.tsc0) * clk.mult) >> 32);
+      break;
+#endif
+    default:
+      mono = read_ns (CLOCK_MONOTONIC);
+      break;
+    }
+  return mono + clock_follow (mono);
+}
+
+unsigned
+ptrace_stamp (char *buf, unsigned long long ts)
+{
+  int j;
+  unsigned i, usec = ts % 1000000000 / 1000;
+  time_t now = ts / 1000000000;
+  struct tm tm;
+
+  if ((long long) now != stamp_cache.sec)
+    {
+      localtime_r (&now, &tm);
+      strftime (stamp_cache.text, sizeof(stamp_cache.text),
+                "%Y-%m-%d %H:%M:%S", &tm);
+      stamp_cache.sec = now;
+    }
+  i = strlen (stamp_cache.text);
+  memcpy (buf, stamp_cache.text, i);
+  buf[i++] = '.';
+  for (j = 5; j >= 0; j--, usec /= 10)
+    {
+      buf[i + j] = '0' + usec % 10;
+    }
+  i += 6;
+  buf[i] = '\0';
+  return i;
+}
@@ -0,0 +1,338 @@
+/*
+ * ptrace_decode.c
+ *  Module     : ptrace
+ *  Description: Reader of binary logs. The whole log is read in, the site
+ *               descriptions are collected first (a thread may log a line
+ *               before another thread's description of the site lands), then
+ *               each line is rendered like a text mode line.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include "ptrace_private.h"
+
+struct decode_site
+{
+  /* NULL until the SITE record is seen */
+  const unsigned char *types;
+  unsigned nargs;
+  int level;
+  unsigned line;
+  const char *file;
+  const char *func;
+  const char *fmt;
+};
+
+struct decoder
+{
+  struct decode_site *site;
+  unsigned nsites;
+  /* Arguments of the line being rendered */
+  const unsigned char *arg;
+  const unsigned char *end;
+};
+
+static unsigned char *
+read_all (FILE *in, size_t *size)
+{
+  size_t n, cap = 64 * 1024;
+  unsigned char *p, *data = malloc (cap);
+
+  *size = 0;
+  while (data && (n = fread (data + *size, 1, cap - *size, in)) > 0)
+    {
+      *size += n;
+      if (*size == cap)
+        {
+          p = realloc (data, cap *= 2);
+          if (NULL == p)
+            {
+              free (data);
+              return NULL;
+            }
+          data = p;
+        }
+    }
+  return data;
+}
+
+static int
+add_site (struct decoder *d, const unsigned char *rec, unsigned len)
+{
+  uint32_t v[2];
+  unsigned n, i;
+  void *p;
+  struct decode_site *site;
+  const char *str[3];
+  const unsigned char *at, *end = rec + len;
+
+  if (len < PTRACE_REC_HDR + 10)
+    {
+      return -1;
+    }
+  memcpy (v, rec + PTRACE_REC_HDR, 8);
+  n = rec[PTRACE_REC_HDR + 9];
+  at = rec + PTRACE_REC_HDR + 10 + (n == PTRACE_ARGS_TEXT ? 0 : n);
+  for (i = 0; i < 3; i++)
+    {
+      str[i] = (const char*) at;
+      at = at < end ? memchr (at, '\0', end - at) : NULL;
+      if (NULL == at)
+        {
+          return -1;
+        }
+      at++;
+    }
+  if (v[0] >= d->nsites)
+    {
+      p = realloc (d->site, (v[0] + 64) * sizeof(*site));
+      if (NULL == p)
+        {
+          return -1;
+        }
+      d->site = p;
+      memset (d->site + d->nsites, 0, (v[0] + 64 - d->nsites) * sizeof(*site));
+      d->nsites = v[0] + 64;
+    }
+  site = &d->site[v[0]];
+  site->line = v[1];
+  site->level = rec[PTRACE_REC_HDR + 8];
+  site->nargs = n;
+  site->types = rec + PTRACE_REC_HDR + 10;
+  site->file = str[0];
+  site->func = str[1];
+  site->fmt = str[2];
+  return 0;
+}
+
+static int
+take (struct decoder *d, void *v, unsigned n)
+{
+  if (d->end - d->arg < (long) n)
+    {
+      return -1;
+    }
+  memcpy (v, d->arg, n);
+  d->arg += n;
+  return 0;
+}
+
+/* Render one conversion spec (copied into spec) with the next arguments */
+static int
+render_spec (struct decoder *d, FILE *out, const char *spec, int stars,
+             int type)
+{
+  int32_t w[2] = { 0, 0 }, i32;
+  int64_t i64;
+  uint64_t u64;
+  uint16_t n;
+  double v;
+  char str[PTRACE_LINE_MAX];
+  int i;
+
+  for (i = 0; i < stars; i++)
+    {
+      if (take (d, &w[i], 4))
+        {
+          return -1;
+        }
+    }
+/* The value after as many star arguments as the spec has */
+#define EMIT(value) \
+  (stars == 0 ? fprintf (out, spec, value) \
+      : stars == 1 ? fprintf (out, spec, w[0], value) \
+      : fprintf (out, spec, w[0], w[1], value))
+  switch (type)
+    {
+    case PTRACE_ARG_INT:
+      if (take (d, &i32, 4))
+        {
+          return -1;
+        }
+      EMIT((int) i32);
+      break;
+    case PTRACE_ARG_LONG:
+      if (take (d, &i64, 8))
+        {
+          return -1;
+        }
+      EMIT((long) i64);
+      break;
+    case PTRACE_ARG_LLONG:
+      if (take (d, &i64, 8))
+        {
+          return -1;
+        }
+      EMIT((long long) i64);
+      break;
+    case PTRACE_ARG_DOUBLE:
+      if (take (d, &v, 8))
+        {
+          return -1;
+        }
+      EMIT(v);
+      break;
+    case PTRACE_ARG_LDOUBLE:
+      if (take (d, &v, 8))
+        {
+          return -1;
+        }
+      EMIT((long double) v);
+      break;
+    case PTRACE_ARG_PTR:
+      if (take (d, &u64, 8))
+        {
+          return -1;
+        }
+      EMIT((void*) (uintptr_t) u64);
+      break;
+    case PTRACE_ARG_STR:
+      if (take (d, &n, 2) || n >= sizeof(str) || take (d, str, n))
+        {
+          return -1;
+        }
+      str[n] = '\0';
+      EMIT(str);
+      break;
+    default:
+      return -1;
+    }
+#undef EMIT
+  return 0;
+}
+
+static int
+render_log (struct decoder *d, FILE *out, const unsigned char *rec,
+            unsigned len)
+{
+  uint32_t id;
+  uint64_t ts;
+  uint16_t n;
+  int stars, type;
+  char prefix[PTRACE_LINE_MAX], spec[64], str[PTRACE_LINE_MAX];
+  const char *p, *q;
+  struct decode_site *site;
+
+  if (len < PTRACE_REC_HDR + 12)
+    {
+      return -1;
+    }
+  memcpy (&id, rec + PTRACE_REC_HDR, 4);
+  memcpy (&ts, rec + PTRACE_REC_HDR + 4, 8);
+  site = id < d->nsites ? &d->site[id] : NULL;
+  /* A line of a site that is not described can not be rendered; the lines
+   * after it still can */
+  if (NULL == site || NULL == site->types)
+    {
+      return 0;
+    }
+  d->arg = rec + PTRACE_REC_HDR + 12;
+  d->end = rec + len;
+  ptrace_prefix (prefix, sizeof(prefix), ts, site->level, site->file,
+                 site->func, site->line);
+  fputs (prefix, out);
+  if (site->nargs == PTRACE_ARGS_TEXT)
+    {
+      if (take (d, &n, 2) || n >= sizeof(str) || take (d, str, n))
+        {
+          return -1;
+        }
+      fwrite (str, 1, n, out);
+      fputc ('\n', out);
+      return 0;
+    }
+  for (p = site->fmt; *p; p = q)
+    {
+      if (*p != '%')
+        {
+          q = strchr (p, '%');
+          q = q ? q : p + strlen (p);
+          fwrite (p, 1, q - p, out);
+          continue;
+        }
+      q = ptrace_spec_parse (p + 1, &stars, &type);
+      if (type == PTRACE_ARG_NONE)
+        {
+          fputc ('%', out);
+          continue;
+        }
+      if ((size_t) (q - p) >= sizeof(spec))
+        {
+          return -1;
+        }
+      memcpy (spec, p, q - p);
+      spec[q - p] = '\0';
+      if (render_spec (d, out, spec, stars, type))
+        {
+          return -1;
+        }
+    }
+  fputc ('\n', out);
+  return 0;
+}
+
+int
+ptrace_decode (FILE *in, FILE *out)
+{
+  int pass, err = 0;
+  uint16_t len;
+  uint32_t bom;
+  size_t size, at;
+  struct decoder d;
+  unsigned char *data = read_all (in, &size);
+
+  if (NULL == data || size < PTRACE_FILE_HDR
+      || memcmp (data, PTRACE_MAGIC, 8))
+    {
+      free (data);
+      return -1;
+    }
+  memcpy (&bom, data + 8, 4);
+  if (bom != PTRACE_BOM)
+    {
+      free (data);
+      return -1;
+    }
+  memset (&d, 0, sizeof(d));
+  /* Sites first, then the lines */
+  for (pass = 0; pass < 2; pass++)
+    {
+      for (at = PTRACE_FILE_HDR; !err && at + PTRACE_REC_HDR <= size;
+          at += len)
+        {
+          memcpy (&len, data + at, 2);
+          if (len < PTRACE_REC_HDR || at + len > size)
+            {
+              err = -1;
+            }
+          else if (pass == 0 && data[at + 2] == PTRACE_REC_SITE)
+            {
+              err = add_site (&d, data + at, len);
+            }
+          else if (pass == 1 && data[at + 2] == PTRACE_REC_LOG)
+            {
+              err = render_log (&d, out, data + at, len);
+            }
+        }
+      /* Render the lines before a damaged record */
+      err = pass == 0 ? 0 : err || at != size ? -1 : 0;
+    }
+  free (d.site);
+  free (data);
+  return err;
+}
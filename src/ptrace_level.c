@@ -0,0 +1,479 @@
+/*
+ * ptrace_level.c
+ *  Module     : ptrace
+ *  Description: Runtime log level. PTrace compares its level against
+ *               ptrace_level with one relaxed load; LOG_LEVEL stays the
+ *               compile-time ceiling. The level is set by the API, by
+ *               $PTRACE_LEVEL at startup, by a signal that cycles it, or by
+ *               a control file polled by a watcher thread.
+ *
+ *               ptrace_control rules set the level of call sites by file
+ *               and function. ptrace_level is then raised to the highest
+ *               level a rule allows, and a site that passes it checks its
+ *               own level: each site caches the rule matching it, and looks
+ *               again when the rules' generation changes.
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ptrace_private.h"
+
+static const char *const LEVEL_NAME[] =
+  { "none", "error", "info", "debug" };
+
+/* A ptrace_control rule; NULL file or func matches any */
+struct level_rule
+{
+  char *file;
+  char *func;
+  int level;
+};
+
+/* What PTrace checks: the highest of the runtime level and the rules' */
+int ptrace_level = DEBUG_LEVEL;
+unsigned ptrace_rules_gen;
+
+static int level_base = DEBUG_LEVEL;
+static int rules_max = NO_LOG;
+
+static pthread_mutex_t rules_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct level_rule *rules;
+static unsigned nrules;
+
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t thread;
+  int running;
+  char *path;
+  unsigned interval_ms;
+} watch =
+  { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+/* A level by number or name ("debug", "DEBUG_LEVEL"), n characters of s.
+ * Returns -1 if s is none of them */
+static int
+level_parse (const char *s, size_t n)
+{
+  int i;
+
+  if (n == 1 && *s >= '0' && *s <= '3')
+    {
+      return *s - '0';
+    }
+  for (i = 0; i < 4; i++)
+    {
+      if ((n == strlen (LEVEL_NAME[i])
+          || (n == strlen (LEVEL_NAME[i]) + 6
+              && !strncasecmp (s + n - 6, "_level", 6)))
+          && !strncasecmp (s, LEVEL_NAME[i], strlen (LEVEL_NAME[i])))
+        {
+          return i;
+        }
+    }
+  return -1;
+}
+
+/* Signal safe: atomic loads and a store */
+static void
+level_gate (void)
+{
+  int base = __atomic_load_n (&level_base, __ATOMIC_RELAXED);
+  int max = __atomic_load_n (&rules_max, __ATOMIC_RELAXED);
+  __atomic_store_n (&ptrace_level, base > max ? base : max, __ATOMIC_RELAXED);
+}
+
+void
+ptrace_set_level (int level)
+{
+  level = level < NO_LOG ? NO_LOG : level > DEBUG_LEVEL ? DEBUG_LEVEL : level;
+  __atomic_store_n (&level_base, level, __ATOMIC_RELAXED);
+  level_gate ();
+}
+
+int
+ptrace_get_level (void)
+{
+  return __atomic_load_n (&level_base, __ATOMIC_RELAXED);
+}
+
+static void __attribute__((constructor))
+level_setup (void)
+{
+  int level;
+  const char *env = getenv ("PTRACE_LEVEL");
+
+  if (env && (level = level_parse (env, strlen (env))) >= 0)
+    {
+      ptrace_set_level (level);
+    }
+}
+
+static int
+rule_match (const struct level_rule *rule, const ptrace_site_t *site)
+{
+  return (NULL == rule->file || !fnmatch (rule->file, site->base, 0)
+      || !fnmatch (rule->file, site->file, 0))
+      && (NULL == rule->func || !fnmatch (rule->func, site->func, 0));
+}
+
+/* Level the rules set for site, -1 if none. Under rules_lock */
+static int
+rule_level (const ptrace_site_t *site)
+{
+  unsigned i;
+  int level = -1;
+
+  for (i = 0; i < nrules; i++)
+    {
+      if (rule_match (&rules[i], site))
+        {
+          level = rules[i].level;
+        }
+    }
+  return level;
+}
+
+/* Publish a change of the rules. Under rules_lock */
+static void
+rules_changed (void)
+{
+  unsigned i, gen = ptrace_rules_gen + 1;
+  int max = NO_LOG;
+
+  for (i = 0; i < nrules; i++)
+    {
+      max = rules[i].level > max ? rules[i].level : max;
+    }
+  __atomic_store_n (&rules_max, max, __ATOMIC_RELAXED);
+  /* Sites compare their rule_gen against it; 0 means no rules ever */
+  __atomic_store_n (&ptrace_rules_gen, gen ? gen : 1, __ATOMIC_RELEASE);
+  level_gate ();
+}
+
+static int
+same (const char *a, const char *b)
+{
+  return a == b || (a && b && !strcmp (a, b));
+}
+
+/* Add, change or (level -1) remove the rule for file and func */
+static int
+rules_set (const char *file, const char *func, int level)
+{
+  unsigned i;
+  void *p;
+  struct level_rule *rule;
+
+  pthread_mutex_lock (&rules_lock);
+  for (i = 0; i < nrules && !(same (rules[i].file, file)
+      && same (rules[i].func, func)); i++)
+    ;
+  if (i < nrules && level < 0)
+    {
+      free (rules[i].file);
+      free (rules[i].func);
+      rules[i] = rules[--nrules];
+    }
+  else if (i < nrules)
+    {
+      rules[i].level = level;
+    }
+  else if (level >= 0)
+    {
+      p = realloc (rules, (nrules + 1) * sizeof(*rules));
+      if (NULL == p)
+        {
+          pthread_mutex_unlock (&rules_lock);
+          return -1;
+        }
+      rules = p;
+      rule = &rules[nrules++];
+      rule->file = file ? strdup (file) : NULL;
+      rule->func = func ? strdup (func) : NULL;
+      rule->level = level;
+    }
+  rules_changed ();
+  pthread_mutex_unlock (&rules_lock);
+  return 0;
+}
+
+static void
+rules_clear (void)
+{
+  pthread_mutex_lock (&rules_lock);
+  while (nrules > 0)
+    {
+      nrules--;
+      free (rules[nrules].file);
+      free (rules[nrules].func);
+    }
+  rules_changed ();
+  pthread_mutex_unlock (&rules_lock);
+}
+
+int
+ptrace_site_check (ptrace_site_t *site, unsigned gen)
+{
+  int level;
+
+  if (__atomic_load_n (&site->rule_gen, __ATOMIC_ACQUIRE) != gen)
+    {
+      if (!__atomic_load_n (&site->id, __ATOMIC_ACQUIRE))
+        {
+          ptrace_site_register (site);
+        }
+      pthread_mutex_lock (&rules_lock);
+      __atomic_store_n (&site->rule_level, rule_level (site),
+                        __ATOMIC_RELAXED);
+      __atomic_store_n (&site->rule_gen, ptrace_rules_gen, __ATOMIC_RELEASE);
+      pthread_mutex_unlock (&rules_lock);
+    }
+  level = __atomic_load_n (&site->rule_level, __ATOMIC_RELAXED);
+  return site->level <= (level >= 0 ? level
+      : __atomic_load_n (&level_base, __ATOMIC_RELAXED));
+}
+
+int
+ptrace_control (const char *cmd)
+{
+  int level = -2, err = 0;
+  const char *file = NULL, *func = NULL;
+  char *copy = strdup (cmd), *save, *key, *value;
+
+  if (NULL == copy)
+    {
+      return -1;
+    }
+  key = strtok_r (copy, " \t\r\n", &save);
+  value = key ? strtok_r (NULL, " \t\r\n", &save) : NULL;
+  /* A blank or comment line does nothing, a bare level is the runtime
+   * level */
+  if (NULL == key || *key == '#')
+    {
+      free (copy);
+      return 0;
+    }
+  if (NULL == value && (level = level_parse (key, strlen (key))) >= 0)
+    {
+      ptrace_set_level (level);
+      free (copy);
+      return 0;
+    }
+  for (level = -2; !err && key && *key != '#';)
+    {
+      if (NULL == value)
+        {
+          err = 1;
+        }
+      else if (!strcmp (key, "file"))
+        {
+          file = value;
+        }
+      else if (!strcmp (key, "func"))
+        {
+          func = value;
+        }
+      else if (!strcmp (key, "level"))
+        {
+          level = strcmp (value, "default") ? level_parse (value,
+                                                           strlen (value))
+              : -1;
+          err = level == -1 && strcmp (value, "default");
+        }
+      else
+        {
+          err = 1;
+        }
+      key = strtok_r (NULL, " \t\r\n", &save);
+      value = key ? strtok_r (NULL, " \t\r\n", &save) : NULL;
+    }
+  if (err || level == -2 || (NULL == file && NULL == func))
+    {
+      free (copy);
+      errno = EINVAL;
+      return -1;
+    }
+  err = rules_set (file, func, level);
+  free (copy);
+  return err;
+}
+
+void
+ptrace_list_sites (FILE *out)
+{
+  int level;
+  ptrace_site_t *site;
+
+  pthread_mutex_lock (&ptrace_site_lock);
+  pthread_mutex_lock (&rules_lock);
+  for (site = ptrace_sites; site; site = site->next)
+    {
+      level = rule_level (site);
+      level = level >= 0 ? level : __atomic_load_n (&level_base,
+                                                    __ATOMIC_RELAXED);
+      fprintf (out, "%s:%d [%s] %s %s \"%s\"\n", site->file, site->line,
+               site->func, LEVEL_NAME[site->level & 3],
+               site->level <= level ? "on" : "off", site->fmt);
+    }
+  pthread_mutex_unlock (&rules_lock);
+  pthread_mutex_unlock (&ptrace_site_lock);
+}
+
+/* ERROR, INFO, DEBUG, then ERROR again. Only atomic loads and stores: safe
+ * in a signal handler */
+static void
+level_cycle (int signo)
+{
+  int level = __atomic_load_n (&level_base, __ATOMIC_RELAXED);
+  (void) signo;
+  __atomic_store_n (&level_base, level >= DEBUG_LEVEL ? ERROR_LEVEL
+                    : level + 1, __ATOMIC_RELAXED);
+  level_gate ();
+}
+
+int
+ptrace_level_signal (int signo)
+{
+  struct sigaction sa;
+
+  memset (&sa, 0, sizeof(sa));
+  sa.sa_handler = level_cycle;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset (&sa.sa_mask);
+  return sigaction (signo, &sa, NULL);
+}
+
+/* Apply the control file, its rules in place of those in force. Returns -1
+ * if it can not be read */
+static int
+watch_read (const char *path)
+{
+  int fd;
+  ssize_t n;
+  size_t len = 0;
+  char *line, *next, buf[16 * 1024];
+
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      return -1;
+    }
+  while (len < sizeof(buf) - 1
+      && (n = read (fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+    {
+      len += n;
+    }
+  close (fd);
+  buf[len] = '\0';
+  rules_clear ();
+  for (line = buf; line; line = next)
+    {
+      next = strchr (line, '\n');
+      if (next)
+        {
+          *next++ = '\0';
+        }
+      ptrace_control (line);
+    }
+  return 0;
+}
+
+static void *
+watch_main (void *arg)
+{
+  struct stat st, seen;
+  struct timespec ts;
+  (void) arg;
+
+  memset (&seen, 0, sizeof(seen));
+  seen.st_mtim.tv_sec = -1;
+  pthread_mutex_lock (&watch.lock);
+  while (watch.running)
+    {
+      /* Read again when the file is replaced or written */
+      if (stat (watch.path, &st) == 0
+          && (st.st_ino != seen.st_ino || st.st_size != seen.st_size
+              || st.st_mtim.tv_sec != seen.st_mtim.tv_sec
+              || st.st_mtim.tv_nsec != seen.st_mtim.tv_nsec))
+        {
+          seen = st;
+          watch_read (watch.path);
+        }
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_sec += watch.interval_ms / 1000;
+      ts.tv_nsec += watch.interval_ms % 1000 * 1000000L;
+      if (ts.tv_nsec >= 1000000000)
+        {
+          ts.tv_sec++;
+          ts.tv_nsec -= 1000000000;
+        }
+      pthread_cond_timedwait (&watch.wake, &watch.lock, &ts);
+    }
+  pthread_mutex_unlock (&watch.lock);
+  return NULL;
+}
+
+int
+ptrace_level_watch (const char *path, unsigned interval_ms)
+{
+  int err = 0;
+  char *copy = path ? strdup (path) : NULL;
+
+  if (path && NULL == copy)
+    {
+      return -1;
+    }
+  pthread_mutex_lock (&watch.lock);
+  if (watch.running)
+    {
+      watch.running = 0;
+      pthread_cond_signal (&watch.wake);
+      pthread_mutex_unlock (&watch.lock);
+      pthread_join (watch.thread, NULL);
+      pthread_mutex_lock (&watch.lock);
+      free (watch.path);
+      watch.path = NULL;
+    }
+  if (copy)
+    {
+      watch.path = copy;
+      watch.interval_ms = interval_ms ? interval_ms : 1000;
+      watch.running = 1;
+      err = pthread_create (&watch.thread, NULL, watch_main, NULL);
+      if (err)
+        {
+          watch.running = 0;
+          watch.path = NULL;
+          free (copy);
+          errno = err;
+          err = -1;
+        }
+    }
+  pthread_mutex_unlock (&watch.lock);
+  return err;
+}
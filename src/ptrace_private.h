@@ -0,0 +1,97 @@
+/*
+ * ptrace_private.h
+ *  Module     : ptrace
+ *  Description: Declarations shared by the ptrace translation units: the
+ *               binary log format and printf conversion parsing. Not
+ *               installed, not part of the API.
+ *
+ *               Binary log layout, integers in the writer's byte order:
+ *                 "PTRACEB1", u32 0x01020304, u32 0
+ *               then records, each starting with u16 length, u8 kind, u8 0:
+ *                 SITE: u32 id, u32 line, u8 level, u8 nargs,
+ *                       u8 types[nargs], file, function and format, each
+ *                       NUL terminated
+ *                 LOG:  u32 id, u64 timestamp (ns since the epoch), the
+ *                       arguments: integers and doubles as 4 or 8 raw bytes,
+ *                       strings as u16 length and bytes
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_PTRACE_PRIVATE_H_
+#define SRC_PTRACE_PRIVATE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "ptrace.h"
+
+#define PTRACE_MAGIC      "PTRACEB1"
+#define PTRACE_BOM        0x01020304u
+#define PTRACE_FILE_HDR   16
+#define PTRACE_REC_HDR    4
+#define PTRACE_REC_SITE   1
+#define PTRACE_REC_LOG    2
+/* nargs of a site whose lines are stored formatted, as one string */
+#define PTRACE_ARGS_TEXT  PTRACE_SITE_TEXT
+
+/* Argument types of a binary record */
+enum
+{
+  PTRACE_ARG_NONE,
+  PTRACE_ARG_BAD,
+  PTRACE_ARG_INT,
+  PTRACE_ARG_LONG,
+  PTRACE_ARG_LLONG,
+  PTRACE_ARG_DOUBLE,
+  PTRACE_ARG_LDOUBLE,
+  PTRACE_ARG_STR,
+  PTRACE_ARG_PTR
+};
+
+/* Registered call sites, newest first, under ptrace_site_lock */
+extern pthread_mutex_t ptrace_site_lock;
+extern ptrace_site_t *ptrace_sites;
+
+/* Fill in the derived fields of a site (id, basename, argument types) on
+ * its first call, and add it to ptrace_sites */
+void
+ptrace_site_register (ptrace_site_t *site);
+
+/* Timestamp of a line, ns since the epoch, from the source chosen with
+ * ptrace_clock */
+unsigned long long
+ptrace_clock_ns (void);
+
+/* "date time.microseconds" of ts into buf (32 bytes). Returns its length */
+unsigned
+ptrace_stamp (char *buf, unsigned long long ts);
+
+/* Parse the conversion starting after a '%'. Sets *stars to the number of
+ * '*' widths and precisions (int arguments before the value) and *type to
+ * the value's type, PTRACE_ARG_NONE for "%%". Returns the character after
+ * the conversion */
+const char *
+ptrace_spec_parse (const char *p, int *stars, int *type);
+
+/* "date time | LEVEL | function | file:line | " for a line stamped ts.
+ * Returns its length, at most cap - 1 */
+unsigned
+ptrace_prefix (char *buf, unsigned cap, unsigned long long ts, int level,
+               const char *file, const char *func, int line);
+
+#endif /* SRC_PTRACE_PRIVATE_H_ */
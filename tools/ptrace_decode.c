@@ -0,0 +1,51 @@
+/*
+ * ptrace_decode.c
+ *  Module     : ptrace
+ *  Description: ptrace-decode: render a binary log written after
+ *               ptrace_init_binary as text.
+ *  Input      : log file (stdin if none)
+ *  Output     : text lines on stdout
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <ptrace.h>
+
+int
+main (int argc, char *argv[])
+{
+  int err;
+  FILE *in = stdin;
+
+  if (argc > 2)
+    {
+      fprintf (stderr, "usage: %s [binary-log]\n", argv[0]);
+      return 2;
+    }
+  if (argc == 2 && NULL == (in = fopen (argv[1], "rb")))
+    {
+      fprintf (stderr, "%s: %s: %s\n", argv[0], argv[1], strerror (errno));
+      return 1;
+    }
+  err = ptrace_decode (in, stdout);
+  if (err)
+    {
+      fprintf (stderr, "%s: not a binary log, or damaged\n", argv[0]);
+    }
+  fclose (in);
+  return err ? 1 : 0;
+}
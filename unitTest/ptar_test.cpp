@@ -21,9 +21,15 @@
  */
 
 #include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <thread>
 #include "gtest/gtest.h"
 
 #include "ptar.h"
+#include "ptar_vfs.h"
 
 namespace
 {
@@ -107,4 +113,830 @@ namespace
         /* Close archive */
         ptar_close (&tar);
       }
+
+#ifdef POSIX_SYSTEM
+  TEST(Stream, CanWriteToPipe)
+  {
+    ptar_t tar;
+    ptar_header_t h;
+    int fds[2];
+    std::string big (3 * PTAR_STREAM_BUFSIZE / 2, 'x');
+    const char *str1 = "Hello world";
+    char *p;
+
+    /* Drain the read end into a regular file */
+    ASSERT_EQ(0, pipe (fds));
+    std::thread reader ([&fds]()
+      {
+        char buf[4096];
+        ssize_t n;
+        FILE *out = fopen ("stream.tar", "wb");
+        while ((n = read (fds[0], buf, sizeof(buf))) > 0)
+          fwrite (buf, 1, n, out);
+        fclose (out);
+      });
+
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_open_stream (&tar, fds[1]));
+    /* Duplicates are written in full: a stream can not read them back */
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_set_dedup (&tar, 1));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file (&tar, "hello1.txt", "hello", 5));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file (&tar, "hello2.txt", "hello", 5));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file_header (&tar, "big.txt", big.size ()));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_data (&tar, big.data (), big.size ()));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file_header (&tar, "test1.txt", strlen (str1)));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_data (&tar, str1, strlen (str1)));
+    EXPECT_NE(PTAR_ESUCCESS, ptar_seek (&tar, 0));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_finalize (&tar));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_close (&tar));
+    close (fds[1]);
+    reader.join ();
+    close (fds[0]);
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open (&tar, "stream.tar", PROT_READ));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "test1.txt", &h));
+    p = (char*) calloc (1, h.size + 1);
+    ptar_read_data (&tar, p, h.size);
+    EXPECT_STREQ(str1, p);
+    free (p);
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "hello2.txt", &h));
+    EXPECT_EQ(PTAR_TREG, (int) h.type);
+    EXPECT_EQ(5U, h.size);
+    ptar_close (&tar);
+  }
+
+  TEST(Append, CanAppendAfterEndOfArchive)
+  {
+    ptar_t tar;
+    ptar_header_t h;
+    struct stat st;
+    const char *str1 = "Hello world";
+    std::string big (10000, 'z');
+    char *p;
+
+    remove ("append.tar");
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open (&tar, "append.tar", PROT_WRITE));
+    ptar_write_file_header (&tar, "test1.txt", strlen (str1));
+    ptar_write_data (&tar, str1, strlen (str1));
+    ptar_finalize (&tar);
+    ptar_close (&tar);
+
+    /* Second member is larger than the file and extends it */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open (&tar, "append.tar", PROT_WRITE | PTAR_APPEND));
+    EXPECT_EQ(1024u, tar.pos);
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file_header (&tar, "big.txt", big.size ()));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_data (&tar, big.data (), big.size ()));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_finalize (&tar));
+    ptar_close (&tar);
+
+    /* File is trimmed to the archive */
+    ASSERT_EQ(0, stat ("append.tar", &st));
+    EXPECT_EQ(1024 + 512 + 10240 + 1024, st.st_size);
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open (&tar, "append.tar", PROT_READ));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "test1.txt", &h));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "big.txt", &h));
+    p = (char*) calloc (1, h.size + 1);
+    ptar_read_data (&tar, p, h.size);
+    EXPECT_EQ(big, p);
+    free (p);
+    ptar_close (&tar);
+  }
+
+  TEST(Delete, CanDeleteAndCompact)
+  {
+    ptar_t tar;
+    ptar_header_t h;
+    struct stat st;
+    const char *names[] = { "a.txt", "b.txt", "c.txt", "d.txt" };
+    std::string data[] = { std::string (10000, 'a'), "b", std::string (20000, 'c'), "d" };
+    int i, steps = 0, err;
+    char *p;
+
+    remove ("delete.tar");
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open (&tar, "delete.tar", PROT_WRITE));
+    for (i = 0; i < 4; i++)
+      {
+        ptar_write_file_header (&tar, names[i], data[i].size ());
+        ptar_write_data (&tar, data[i].data (), data[i].size ());
+      }
+    ptar_finalize (&tar);
+
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_delete (&tar, "a.txt"));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_delete (&tar, "c.txt"));
+    EXPECT_EQ(PTAR_ENOTFOUND, ptar_delete (&tar, "c.txt"));
+    EXPECT_EQ(PTAR_ENOTFOUND, ptar_find (&tar, "a.txt", &h));
+
+    /* One member per step; live members stay readable in between */
+    while ((err = ptar_compact (&tar, 1)) == 1)
+      {
+        steps++;
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "d.txt", &h));
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "b.txt", &h));
+      }
+    EXPECT_EQ(PTAR_ESUCCESS, err);
+    EXPECT_EQ(1, steps);
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_compact (&tar, 0));
+    ptar_close (&tar);
+
+    ASSERT_EQ(0, stat ("delete.tar", &st));
+    EXPECT_EQ(2 * 1024 + 1024, st.st_size);
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open (&tar, "delete.tar", PROT_READ));
+    for (i = 1; i < 4; i += 2)
+      {
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, names[i], &h));
+        p = (char*) calloc (1, h.size + 1);
+        ptar_read_data (&tar, p, h.size);
+        EXPECT_EQ(data[i], p);
+        free (p);
+      }
+    ptar_close (&tar);
+  }
+
+  TEST(Framed, CanReadRangesOfFramedMember)
+  {
+    ptar_t tar;
+    ptar_header_t h;
+    std::string text;
+    const char *str1 = "Hello world";
+    const void *data;
+    unsigned size;
+    char *p;
+    int codec;
+
+    for (int i = 0; i < 20000; i++)
+      text += "line " + std::to_string (i % 100) + "\n";
+    /* Library may be built without zlib */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar, NULL));
+    codec = PTAR_CODEC_ZLIB;
+    if (PTAR_ENOTSUP == ptar_write_file_framed (&tar, "text.txt", text.data (), text.size (), codec, 4096))
+      {
+        codec = PTAR_CODEC_NONE;
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_write_file_framed (&tar, "text.txt", text.data (), text.size (), codec, 4096));
+      }
+    ptar_write_file_header (&tar, "test1.txt", strlen (str1));
+    ptar_write_data (&tar, str1, strlen (str1));
+    ptar_finalize (&tar);
+    ptar_membuf_data (&tar, &data, &size);
+    if (codec == PTAR_CODEC_ZLIB)
+      {
+        EXPECT_GT(text.size () / 2, size);
+      }
+
+    /* Reads like a regular file of the uncompressed size */
+    ptar_t mem;
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_memory (&mem, data, size));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&mem, "text.txt", &h));
+    EXPECT_EQ(PTAR_TFRAMED, (int) h.type);
+    ASSERT_EQ(text.size (), h.size);
+    p = (char*) calloc (1, h.size + 1);
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_read_data (&mem, p, 1000));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_read_data (&mem, p + 1000, h.size - 1000));
+    EXPECT_EQ(text, p);
+
+    /* Range across a frame boundary */
+    memset (p, 0, h.size);
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_read_range (&mem, 4000, p, 9000));
+    EXPECT_EQ(text.substr (4000, 9000), p);
+    EXPECT_EQ(PTAR_EREADFAIL, ptar_read_range (&mem, h.size - 1, p, 2));
+
+    /* Small reads are served from the frame decoded last */
+    memset (p, 0, h.size);
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&mem, "text.txt", &h));
+    for (unsigned at = 0, n; at < h.size; at += n)
+      {
+        n = h.size - at < 500 ? h.size - at : 500;
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_read_data (&mem, p + at, n));
+      }
+    EXPECT_EQ(text, p);
+    free (p);
+
+    /* Members after it are still found */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&mem, "test1.txt", &h));
+    EXPECT_EQ(strlen (str1), h.size);
+    ptar_close (&mem);
+    ptar_close (&tar);
+  }
+
+  TEST(Framed, CanShareTrainedDictionary)
+  {
+    ptar_t tar[2], mem;
+    ptar_header_t h;
+    std::vector<std::string> docs;
+    std::vector<const void*> samples;
+    std::vector<unsigned> sizes;
+    const void *data[2];
+    unsigned size[2];
+    int codecs[2] = { PTAR_CODEC_ZSTD, PTAR_CODEC_ZLIB };
+    int codec = PTAR_CODEC_NONE;
+    char name[32];
+
+    /* Many small members sharing most of their text, which compresses
+     * badly on its own */
+    std::string shared;
+    for (unsigned i = 0, x = 12345; i < 300; i++, x = x * 1103515245u + 12345u)
+      shared += "\"k" + std::to_string (x >> 20) + "\": " + std::to_string ((x >> 8) & 0xfff) + ", ";
+    for (int i = 0; i < 300; i++)
+      {
+        docs.push_back ("{\"id\": " + std::to_string (i) + ", " + shared + "\"end\": null}");
+      }
+    for (size_t i = 0; i < docs.size (); i++)
+      {
+        samples.push_back (docs[i].data ());
+        sizes.push_back (docs[i].size ());
+      }
+    for (int c = 0; c < 2 && codec == PTAR_CODEC_NONE; c++)
+      {
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar[1], NULL));
+        if (PTAR_ESUCCESS == ptar_write_dict (&tar[1], codecs[c], &samples[0], &sizes[0], 100, 16 * 1024))
+          codec = codecs[c];
+        else
+          ptar_close (&tar[1]);
+      }
+    if (codec == PTAR_CODEC_NONE)
+      return;
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar[0], NULL));
+    for (int t = 0; t < 2; t++)
+      {
+        for (size_t i = 0; i < docs.size (); i++)
+          {
+            /* The second half uses a dictionary of its own */
+            if (t == 1 && i == 150)
+              {
+                ASSERT_EQ(PTAR_ESUCCESS, ptar_write_dict (&tar[1], codec, &samples[150], &sizes[150], 100, 8 * 1024));
+              }
+            sprintf (name, "conf/%d.json", (int) i);
+            ASSERT_EQ(PTAR_ESUCCESS, ptar_write_file_framed (&tar[t], name, docs[i].data (), docs[i].size (), codec, 0));
+          }
+        ptar_finalize (&tar[t]);
+        ptar_membuf_data (&tar[t], &data[t], &size[t]);
+      }
+    EXPECT_GT(size[0], size[1]);
+
+    /* A fresh reader loads the dictionary from the archive */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_memory (&mem, data[1], size[1]));
+    for (int i = 299; i >= 0; i -= 37)
+      {
+        sprintf (name, "conf/%d.json", i);
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&mem, name, &h));
+        std::string out (h.size, '\0');
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_read_data (&mem, &out[0], h.size));
+        EXPECT_EQ(docs[i], out);
+      }
+    /* Alternating between the two dictionaries */
+    for (int i = 0; i < 20; i++)
+      {
+        sprintf (name, "conf/%d.json", i % 2 ? 299 - i : i);
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&mem, name, &h));
+        std::string out (h.size, '\0');
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_read_data (&mem, &out[0], h.size));
+        EXPECT_EQ(docs[i % 2 ? 299 - i : i], out);
+      }
+    ptar_close (&mem);
+    ptar_close (&tar[0]);
+    ptar_close (&tar[1]);
+  }
+
+  TEST(Dedup, CanStoreDuplicatesAsHardLinks)
+  {
+    ptar_t tar[2], mem;
+    ptar_header_t h;
+    std::string obj (100000, 'o'), other (obj);
+    const void *data;
+    unsigned size[2];
+    char p[16];
+
+    other[5000] = 'x';
+    for (int t = 0; t < 2; t++)
+      {
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar[t], NULL));
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_set_dedup (&tar[t], t));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file (&tar[t], "a/lib.o", obj.data (), obj.size ()));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file (&tar[t], "b/lib.o", obj.data (), obj.size ()));
+        /* Same size and nearly the same bytes is not a duplicate */
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file (&tar[t], "c/lib.o", other.data (), other.size ()));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file (&tar[t], "d/lib.o", obj.data (), obj.size ()));
+        ptar_finalize (&tar[t]);
+        ptar_membuf_data (&tar[t], &data, &size[t]);
+      }
+    EXPECT_EQ(size[0] - 2 * (obj.size () + 512 - obj.size () % 512), size[1]);
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_memory (&mem, data, size[1]));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&mem, "d/lib.o", &h));
+    EXPECT_EQ(PTAR_TLNK, (int) h.type);
+    EXPECT_STREQ("a/lib.o", h.linkname);
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&mem, "c/lib.o", &h));
+    EXPECT_EQ(PTAR_TREG, (int) h.type);
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_read_range (&mem, 4995, p, 10));
+    EXPECT_EQ(0, memcmp (p, "oooooxoooo", 10));
+    ptar_close (&mem);
+    ptar_close (&tar[0]);
+    ptar_close (&tar[1]);
+  }
+
+  TEST(Sparse, CanAddAndExtractSparseFile)
+  {
+    ptar_t tar;
+    ptar_header_t h;
+    struct stat st;
+    const unsigned mb = 1024 * 1024;
+    char p[8];
+    int fd;
+
+    /* 64 MiB file with data in 6 places, so the map needs an extension record */
+    fd = open ("sparse.img", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(0, ftruncate (fd, 64 * mb));
+    for (int i = 0; i < 6; i++)
+      EXPECT_EQ(4, pwrite (fd, "data", 4, i * 10 * mb + 1000));
+    close (fd);
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open (&tar, "sparse.tar", PROT_WRITE));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_add_file (&tar, "sparse.img", "sparse.img"));
+    ptar_write_file_header (&tar, "test1.txt", 5);
+    ptar_write_data (&tar, "Hello", 5);
+    ptar_finalize (&tar);
+    ptar_close (&tar);
+    ASSERT_EQ(0, stat ("sparse.tar", &st));
+    EXPECT_GT(2 * mb, (unsigned) st.st_size);
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open (&tar, "sparse.tar", PROT_READ));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "sparse.img", &h));
+    EXPECT_EQ(PTAR_TSPARSE, (int) h.type);
+    EXPECT_EQ(64 * mb, h.size);
+    /* Holes read as zeros */
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_read_range (&tar, 30 * mb + 998, p, 8));
+    EXPECT_EQ(0, memcmp (p, "\0\0data\0\0", 8));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_extract (&tar, "sparse.img", "sparse.out"));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "test1.txt", &h));
+    EXPECT_EQ(5u, h.size);
+    ptar_close (&tar);
+
+    ASSERT_EQ(0, stat ("sparse.out", &st));
+    EXPECT_EQ(64 * mb, (unsigned) st.st_size);
+    EXPECT_GT(2 * mb, (unsigned) st.st_blocks * 512);
+    fd = open ("sparse.out", O_RDONLY);
+    EXPECT_EQ(4, pread (fd, p, 4, 50 * mb + 1000));
+    EXPECT_EQ(0, memcmp (p, "data", 4));
+    close (fd);
+  }
+
+  TEST(Index, CanAnswerMissesFromBloomFilter)
+  {
+    ptar_t tar;
+    ptar_header_t h;
+    ptar_index_stats_t st;
+    char name[32], p[16];
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar, NULL));
+    for (int i = 0; i < 1000; i++)
+      {
+        sprintf (name, "file%d.txt", i);
+        ptar_write_file (&tar, name, name, strlen (name));
+      }
+    ptar_finalize (&tar);
+    EXPECT_EQ(PTAR_EFAILURE, ptar_index_stats (&tar, &st));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_index_build (&tar));
+
+    for (int i = 0; i < 1000; i++)
+      {
+        sprintf (name, "override%d.txt", i);
+        EXPECT_EQ(PTAR_ENOTFOUND, ptar_find (&tar, name, &h));
+      }
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "file777.txt", &h));
+    memset (p, 0, sizeof(p));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_read_data (&tar, p, h.size));
+    EXPECT_STREQ("file777.txt", p);
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_index_stats (&tar, &st));
+    EXPECT_EQ(1000u, st.members);
+    EXPECT_EQ(1001u, st.lookups);
+    EXPECT_EQ(1000u, st.bloom_negatives + st.false_positives);
+    EXPECT_GT(20u, st.false_positives);
+    EXPECT_GT(0.05, st.fp_rate);
+
+    /* Members added later are indexed, the end is known */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_seek_end (&tar));
+    ptar_write_file (&tar, "late.txt", "late", 4);
+    ptar_finalize (&tar);
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "late.txt", &h));
+    EXPECT_EQ(4u, h.size);
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "file0.txt", &h));
+    ptar_index_drop (&tar);
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "late.txt", &h));
+    ptar_close (&tar);
+  }
+
+  static int
+  collect_names (void *ctx, const ptar_entry_t *e)
+  {
+    std::string *out = (std::string*) ctx;
+    *out += e->name;
+    *out += ' ';
+    return 0;
+  }
+
+  TEST(Index, CanListByPrefixAndGlob)
+  {
+    ptar_t tar;
+    std::string out;
+    const char *names[] =
+      { "src/b.c", "doc/readme", "src/a.h", "src/a.c", "src/sub/c.c", "srcx",
+          "src/[x].c" };
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar, NULL));
+    for (unsigned i = 0; i < 7; i++)
+      {
+        ptar_write_file (&tar, names[i], names[i], strlen (names[i]));
+      }
+    ptar_finalize (&tar);
+
+    /* The index is built on first use and lists in name order */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_list_prefix (&tar, "src/", collect_names, &out));
+    EXPECT_EQ("src/[x].c src/a.c src/a.h src/b.c src/sub/c.c ", out);
+    out.clear ();
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_list_glob (&tar, "src/*.c", collect_names, &out));
+    EXPECT_EQ("src/[x].c src/a.c src/b.c src/sub/c.c ", out);
+    out.clear ();
+    ptar_list_glob (&tar, "src/[!b]?[ch]", collect_names, &out);
+    EXPECT_EQ("src/a.c src/a.h ", out);
+    out.clear ();
+    ptar_list_glob (&tar, "src/\\[x\\]*", collect_names, &out);
+    EXPECT_EQ("src/[x].c ", out);
+    EXPECT_EQ(PTAR_EFAILURE, ptar_list_glob (&tar, "src/[ab", collect_names, &out));
+
+    /* Later writes and deletes show up */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_seek_end (&tar));
+    ptar_write_file (&tar, "src/0.c", "0", 1);
+    ptar_finalize (&tar);
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_delete (&tar, "src/b.c"));
+    out.clear ();
+    ptar_list_glob (&tar, "*.c", collect_names, &out);
+    EXPECT_EQ("src/0.c src/[x].c src/a.c src/sub/c.c ", out);
+    /* A member written since the last listing */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_seek_end (&tar));
+    ptar_write_file (&tar, "src/1.c", "1", 1);
+    ptar_finalize (&tar);
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_delete (&tar, "src/1.c"));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_delete (&tar, "src/a.c"));
+    out.clear ();
+    ptar_list_glob (&tar, "*.c", collect_names, &out);
+    EXPECT_EQ("src/0.c src/[x].c src/sub/c.c ", out);
+    ptar_close (&tar);
+  }
+
+  TEST(Vfs, CanStatAndReadDirectories)
+  {
+    ptar_t tar;
+    ptar_vfs_t vfs;
+    ptar_stat_t st;
+    ptar_dir_t dir;
+    std::string out;
+    char p[8];
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar, NULL));
+    ptar_write_dir_header (&tar, "docs/");
+    ptar_write_file (&tar, "./docs/a.txt", "aaa", 3);
+    ptar_write_file (&tar, "src/lib/x.c", "x", 1);
+    ptar_write_file (&tar, "src/main.c", "main", 4);
+    ptar_write_file (&tar, "docs/a.txt", "newer", 5);
+    ptar_finalize (&tar);
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_vfs_open (&vfs, &tar));
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_stat (&vfs, "docs", &st));
+    EXPECT_EQ((unsigned) PTAR_TDIR, st.type);
+    EXPECT_EQ(0775u, st.mode);
+    EXPECT_EQ(0, st.implied);
+    /* Parents of names are directories too */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_stat (&vfs, "/src//lib/", &st));
+    EXPECT_EQ((unsigned) PTAR_TDIR, st.type);
+    EXPECT_EQ(1, st.implied);
+    EXPECT_EQ(PTAR_ENOTFOUND, ptar_stat (&vfs, "src/lib/y.c", &st));
+
+    /* The last entry of a name wins, and its data is at its offset */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_stat (&vfs, "src/../docs/./a.txt", &st));
+    EXPECT_STREQ("a.txt", st.name);
+    EXPECT_EQ(5u, st.size);
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_seek (&tar, st.offset));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_read_range (&tar, 0, p, 5));
+    EXPECT_EQ(0, memcmp (p, "newer", 5));
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_opendir (&vfs, "", &dir));
+    while (ptar_readdir (&dir, &st) == PTAR_ESUCCESS)
+      {
+        out += st.name;
+        out += ' ';
+      }
+    EXPECT_EQ("docs src ", out);
+    out.clear ();
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_opendir (&vfs, "src", &dir));
+    while (ptar_readdir (&dir, &st) == PTAR_ESUCCESS)
+      {
+        out += st.name;
+        out += ' ';
+      }
+    EXPECT_EQ("lib main.c ", out);
+    EXPECT_EQ(PTAR_ENOTDIR, ptar_opendir (&vfs, "src/main.c", &dir));
+    ptar_vfs_close (&vfs);
+    ptar_close (&tar);
+  }
+
+  TEST(Memory, CanBuildAndReadArchiveInMemory)
+  {
+    ptar_t tar, mem;
+    ptar_header_t h;
+    struct iovec iov[8];
+    std::string big (3 * PTAR_MEMBUF_CHUNK, 'y');
+    const char *str2 = "Goodbye world";
+    const void *data;
+    unsigned size;
+    char *p;
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar, NULL));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file_header (&tar, "big.txt", big.size ()));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_data (&tar, big.data (), big.size ()));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file_header (&tar, "test2.txt", strlen (str2)));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_write_data (&tar, str2, strlen (str2)));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_finalize (&tar));
+    /* Data spans several arenas until it is asked for as one buffer */
+    EXPECT_LT(1, ptar_membuf_iov (&tar, iov, 8));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_membuf_data (&tar, &data, &size));
+    EXPECT_EQ(1, ptar_membuf_iov (&tar, iov, 8));
+    EXPECT_EQ(size, iov[0].iov_len);
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_memory (&mem, data, size));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&mem, "test2.txt", &h));
+    p = (char*) calloc (1, h.size + 1);
+    ptar_read_data (&mem, p, h.size);
+    EXPECT_STREQ(str2, p);
+    free (p);
+    EXPECT_EQ(PTAR_ENOTFOUND, ptar_find (&mem, "missing.txt", &h));
+    /* A seek past the end fails and leaves the position alone */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_seek (&mem, 512));
+    EXPECT_EQ(PTAR_ESEEKFAIL, ptar_seek (&mem, size + 1));
+    EXPECT_EQ(PTAR_ESEEKFAIL, ptar_seek (&tar, size + 1));
+    EXPECT_EQ(512U, mem.pos);
+    ptar_close (&mem);
+    ptar_close (&tar);
+  }
+
+  TEST(Memory, CanOpenEmbeddedWindow)
+  {
+    ptar_t tar;
+    ptar_header_t h;
+    const char *str1 = "Hello world";
+    std::string prefix (1000, '#');
+    const void *data;
+    unsigned size;
+    char p[32];
+    int fd, flags[2] = { PROT_READ, PROT_READ | PTAR_FD_PREAD };
+
+    /* Bundle = unaligned junk + archive + junk */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar, NULL));
+    ptar_write_file_header (&tar, "test1.txt", strlen (str1));
+    ptar_write_data (&tar, str1, strlen (str1));
+    ptar_finalize (&tar);
+    ptar_membuf_data (&tar, &data, &size);
+    fd = open ("bundle.bin", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_NE(-1, fd);
+    EXPECT_EQ((ssize_t) prefix.size (), write (fd, prefix.data (), prefix.size ()));
+    EXPECT_EQ((ssize_t) size, write (fd, data, size));
+    EXPECT_EQ((ssize_t) prefix.size (), write (fd, prefix.data (), prefix.size ()));
+    ptar_close (&tar);
+
+    for (int i = 0; i < 2; i++)
+      {
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_open_fd (&tar, fd, prefix.size (), size, flags[i]));
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "test1.txt", &h));
+        memset (p, 0, sizeof(p));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_read_data (&tar, p, h.size));
+        EXPECT_STREQ(str1, p);
+        ptar_close (&tar);
+      }
+    /* Without a protection the window is read */
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_fd (&tar, fd, prefix.size (), size, 0));
+    EXPECT_EQ(PTAR_ESUCCESS, ptar_find (&tar, "test1.txt", &h));
+    ptar_close (&tar);
+    /* A window that does not start at an archive is rejected */
+    EXPECT_NE(PTAR_ESUCCESS, ptar_open_fd (&tar, fd, 0, 0, PROT_READ));
+    /* So is one read past the end of the file */
+    EXPECT_NE(PTAR_ESUCCESS, ptar_open_fd (&tar, fd, prefix.size (), 1 << 20, PROT_READ));
+    close (fd);
+  }
+
+  TEST(Memory, CanOpenNestedArchives)
+  {
+    ptar_t shard, release, bundle, outer, inner, innermost;
+    ptar_header_t h;
+    const char *str1 = "Hello world";
+    const void *data, *ptr;
+    unsigned size;
+
+    /* bundle holds release.tar, which holds shard.tar, which holds test1.txt */
+    ptar_open_membuf (&shard, NULL);
+    ptar_write_file_header (&shard, "test1.txt", strlen (str1));
+    ptar_write_data (&shard, str1, strlen (str1));
+    ptar_finalize (&shard);
+    ptar_membuf_data (&shard, &data, &size);
+
+    ptar_open_membuf (&release, NULL);
+    ptar_write_file_header (&release, "shard.tar", size);
+    ptar_write_data (&release, data, size);
+    ptar_finalize (&release);
+    ptar_close (&shard);
+    ptar_membuf_data (&release, &data, &size);
+
+    ptar_open_membuf (&bundle, NULL);
+    ptar_write_file_header (&bundle, "release.tar", size);
+    ptar_write_data (&bundle, data, size);
+    ptar_finalize (&bundle);
+    ptar_close (&release);
+    ptar_membuf_data (&bundle, &data, &size);
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_memory (&outer, data, size));
+    EXPECT_EQ(PTAR_ENOTFOUND, ptar_open_member (&outer, "missing.tar", &inner));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_member (&outer, "release.tar", &inner));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_member (&inner, "shard.tar", &innermost));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&innermost, "test1.txt", &h));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_get_pointer (&innermost, &ptr));
+    /* Innermost data points into the outer buffer */
+    EXPECT_TRUE(ptr > data && (const char*) ptr < (const char*) data + size);
+    EXPECT_EQ(0, memcmp (ptr, str1, h.size));
+    ptar_close (&innermost);
+    ptar_close (&inner);
+    ptar_close (&outer);
+    ptar_close (&bundle);
+  }
+
+  TEST(Compressed, CanWriteAndReadTarGz)
+  {
+    ptar_t tar, gz, tgz;
+    ptar_header_t h;
+    std::string big (3 * PTAR_CODEC_BUFSIZE, 'z');
+    const char *str1 = "Hello world";
+    const void *data;
+    unsigned size;
+    char p[32];
+    int codecs[2] = { PTAR_CODEC_GZIP, PTAR_CODEC_ZSTD };
+
+    for (int i = 0; i < 2; i++)
+      {
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar, NULL));
+        if (PTAR_ENOTSUP == ptar_open_compressed (&gz, &tar, codecs[i], PROT_WRITE))
+          {
+            ptar_close (&tar);
+            continue;
+          }
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file_header (&gz, "test1.txt", strlen (str1)));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_data (&gz, str1, strlen (str1)));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file_header (&gz, "big.txt", big.size ()));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_data (&gz, big.data (), big.size ()));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_finalize (&gz));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_close (&gz));
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_membuf_data (&tar, &data, &size));
+        EXPECT_GT(big.size () / 10, size);
+
+        /* Read the compressed bytes back from the start of the buffer */
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_seek (&tar, 0));
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_open_compressed (&tgz, &tar, codecs[i], PROT_READ));
+        EXPECT_EQ(PTAR_ENOTFOUND, ptar_find (&tgz, "missing.txt", &h));
+        /* Going back to the first member decodes again from the start */
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tgz, "test1.txt", &h));
+        memset (p, 0, sizeof(p));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_read_data (&tgz, p, h.size));
+        EXPECT_STREQ(str1, p);
+        ptar_close (&tgz);
+        ptar_close (&tar);
+      }
+  }
+
+  TEST(Compressed, CanCompressBlocksInParallel)
+  {
+    ptar_t tar, gz, tgz;
+    ptar_header_t h;
+    std::string big;
+    const char *str1 = "Hello world";
+    int codecs[2] = { PTAR_CODEC_GZIP, PTAR_CODEC_ZSTD };
+
+    /* Several blocks worth of compressible but varying data */
+    for (unsigned i = 0; big.size () < 5 * PTAR_CODEC_BLOCK + 100; i++)
+      {
+        big += std::to_string (i * 7919u % 100003u) + ",";
+      }
+    for (int i = 0; i < 2; i++)
+      {
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar, NULL));
+        if (PTAR_ESUCCESS != ptar_open_compressed_mt (&gz, &tar, codecs[i], 4))
+          {
+            ptar_close (&tar);
+            continue;
+          }
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file_header (&gz, "big.txt", big.size ()));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_data (&gz, big.data (), big.size ()));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_file_header (&gz, "test1.txt", strlen (str1)));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_write_data (&gz, str1, strlen (str1)));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_finalize (&gz));
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_close (&gz));
+
+        /* Output is an ordinary concatenated stream */
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_seek (&tar, 0));
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_open_compressed (&tgz, &tar, codecs[i], PROT_READ));
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tgz, "big.txt", &h));
+        ASSERT_EQ(big.size (), h.size);
+        std::string out (h.size, '\0');
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_read_data (&tgz, &out[0], h.size));
+        EXPECT_TRUE(out == big);
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_find (&tgz, "test1.txt", &h));
+        ptar_close (&tgz);
+        ptar_close (&tar);
+      }
+  }
+
+  /* One gzip member holding data in stored blocks, padded with an extra
+   * field of the given length */
+  std::string
+  gzip_stored (const std::string &data, unsigned extra)
+  {
+    std::string out ("\x1f\x8b\x08\x04\0\0\0\0\0\xff", 10);
+    uint32_t crc = 0xffffffff;
+    size_t at = 0, n;
+
+    out += (char) (extra & 0xff);
+    out += (char) (extra >> 8);
+    out.append (extra, 'x');
+    do
+      {
+        n = data.size () - at < 65535 ? data.size () - at : 65535;
+        out += (char) (at + n == data.size ());
+        out += (char) (n & 0xff);
+        out += (char) (n >> 8);
+        out += (char) (~n & 0xff);
+        out += (char) ((~n >> 8) & 0xff);
+        out.append (data, at, n);
+        at += n;
+      }
+    while (at < data.size ());
+    for (unsigned char c : data)
+      {
+        crc ^= c;
+        for (int k = 0; k < 8; k++)
+          {
+            crc = crc >> 1 ^ (0xedb88320 & (0 - (crc & 1)));
+          }
+      }
+    crc = ~crc;
+    for (int k = 0; k < 4; k++)
+      {
+        out += (char) (crc >> 8 * k);
+      }
+    for (int k = 0; k < 4; k++)
+      {
+        out += (char) (data.size () >> 8 * k);
+      }
+    return out;
+  }
+
+  TEST(Compressed, CanReadMemberBoundaryAtBufferEnd)
+  {
+    ptar_t tar, raw, tgz;
+    ptar_header_t h;
+    std::string big, gz, first;
+    const void *data;
+    unsigned size, cut = 200000;
+
+    for (unsigned i = 0; big.size () < 600000; i++)
+      {
+        big += std::to_string (i) + ",";
+      }
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&tar, NULL));
+    ptar_write_file_header (&tar, "big.txt", big.size ());
+    ptar_write_data (&tar, big.data (), big.size ());
+    ptar_write_file_header (&tar, "tail.txt", 4);
+    ptar_write_data (&tar, "tail", 4);
+    ptar_finalize (&tar);
+    ptar_membuf_data (&tar, &data, &size);
+
+    /* The second member's magic starts at the last byte of the first chunk
+     * of input the decoder reads */
+    first.assign ((const char*) data, cut);
+    gz = gzip_stored (first, 0);
+    gz = gzip_stored (first, PTAR_CODEC_BUFSIZE - 1 - gz.size ());
+    ASSERT_EQ(PTAR_CODEC_BUFSIZE - 1, gz.size ());
+    gz += gzip_stored (std::string ((const char*) data + cut, size - cut), 0);
+
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_open_membuf (&raw, NULL));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_write_data (&raw, gz.data (), gz.size ()));
+    ASSERT_EQ(PTAR_ESUCCESS, ptar_seek (&raw, 0));
+    if (PTAR_ESUCCESS == ptar_open_compressed (&tgz, &raw, PTAR_CODEC_GZIP, PROT_READ))
+      {
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tgz, "big.txt", &h));
+        std::string out (h.size, '\0');
+        EXPECT_EQ(PTAR_ESUCCESS, ptar_read_data (&tgz, &out[0], h.size));
+        EXPECT_TRUE(out == big);
+        ASSERT_EQ(PTAR_ESUCCESS, ptar_find (&tgz, "tail.txt", &h));
+        ptar_close (&tgz);
+      }
+    ptar_close (&raw);
+    ptar_close (&tar);
+  }
+#endif
 }
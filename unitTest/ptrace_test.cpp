@@ -0,0 +1,572 @@
+/*
+ * ptrace_test.cpp
+ *  Module     :
+ *  Description:
+ *  Input      :
+ *  Output     :
+ *  Created on : 19-Oct-2026
+ *  Author     : pratik
+ *  License     :
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 3 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <csignal>
+#include <dirent.h>
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "ptrace.hpp"
+
+namespace
+{
+  std::string
+  read_file (const char *path)
+  {
+    std::ifstream in (path);
+    std::stringstream ss;
+    ss << in.rdbuf ();
+    return ss.str ();
+  }
+
+  int
+  count_fds ()
+  {
+    int n = 0;
+    DIR *d = opendir ("/proc/self/fd");
+    while (d && readdir (d))
+      {
+        n++;
+      }
+    if (d)
+      {
+        closedir (d);
+      }
+    return n;
+  }
+
+  TEST(Sink, KeepsOneDescriptorAndBuffersLines)
+  {
+    const char *path = "ptrace_sink.log";
+    std::string log;
+    int fds;
+
+    remove (path);
+    ASSERT_EQ(0, ptrace_init (path));
+    fds = count_fds ();
+    for (int i = 0; i < 100; i++)
+      {
+        PTrace(ERROR_LEVEL, "line %d", i);
+      }
+    EXPECT_EQ(fds, count_fds ());
+    /* Buffered until flushed */
+    EXPECT_EQ(0u, read_file (path).size ());
+    ptrace_flush ();
+    log = read_file (path);
+    EXPECT_NE(std::string::npos, log.find ("| ERROR   | "));
+    EXPECT_NE(std::string::npos, log.find ("ptrace_test.cpp | TestBody:"));
+    EXPECT_NE(std::string::npos, log.find ("| line 99\n"));
+
+    /* Overlong lines are cut but still end the line */
+    PTrace(INFO_LEVEL, "%s", std::string (4 * PTRACE_LINE_MAX, 'x').c_str ());
+    ptrace_shutdown ();
+    log = read_file (path);
+    EXPECT_EQ('\n', log[log.size () - 1]);
+    EXPECT_EQ(std::string::npos, log.find (std::string (PTRACE_LINE_MAX, 'x')));
+    remove (path);
+  }
+
+  unsigned
+  count_lines (const std::string &s, const char *needle)
+  {
+    unsigned n = 0;
+    for (size_t at = 0; (at = s.find (needle, at)) != std::string::npos; at++)
+      {
+        n++;
+      }
+    return n;
+  }
+
+  void
+  log_lines (int count)
+  {
+    for (int i = 0; i < count; i++)
+      {
+        PTrace(INFO_LEVEL, "async %d", i);
+      }
+  }
+
+  TEST(Async, WritesEveryLineUnderBlockPolicy)
+  {
+    const char *path = "ptrace_async.log";
+    std::vector<std::thread> threads;
+    ptrace_stats_t before, after;
+
+    remove (path);
+    ASSERT_EQ(0, ptrace_init (path));
+    ptrace_stats (&before);
+    ASSERT_EQ(0, ptrace_async_start (16, PTRACE_BLOCK));
+    for (int i = 0; i < 4; i++)
+      {
+        threads.push_back (std::thread (log_lines, 5000));
+      }
+    for (auto &t : threads)
+      {
+        t.join ();
+      }
+    ptrace_flush ();
+    ptrace_stats (&after);
+    EXPECT_EQ(20000u, after.written - before.written);
+    EXPECT_EQ(before.dropped_newest, after.dropped_newest);
+    EXPECT_EQ(20000u, count_lines (read_file (path), "| async "));
+    ptrace_shutdown ();
+    remove (path);
+  }
+
+  TEST(Async, CountsDroppedLines)
+  {
+    const char *path = "ptrace_drop.log";
+    ptrace_stats_t before, after;
+
+    remove (path);
+    ASSERT_EQ(0, ptrace_init (path));
+    ptrace_stats (&before);
+    ASSERT_EQ(0, ptrace_async_start (16, PTRACE_DROP_OLDEST));
+    log_lines (20000);
+    ptrace_shutdown ();
+    ptrace_stats (&after);
+    EXPECT_EQ(20000u, after.written - before.written
+              + after.dropped_oldest - before.dropped_oldest
+              + after.dropped_newest - before.dropped_newest);
+    EXPECT_EQ(after.written - before.written,
+              count_lines (read_file (path), "| async "));
+    /* The newest lines survive */
+    EXPECT_NE(std::string::npos, read_file (path).find ("| async 19999\n"));
+    remove (path);
+  }
+
+  TEST(Async, MergesThreadsByTimestamp)
+  {
+    const char *path = "ptrace_merge.log";
+    std::vector<std::thread> threads;
+    std::string log, stamp, last;
+    size_t at = 0, end;
+
+    remove (path);
+    ASSERT_EQ(0, ptrace_init (path));
+    ASSERT_EQ(0, ptrace_async_start (4096, PTRACE_BLOCK));
+    for (int i = 0; i < 8; i++)
+      {
+        threads.push_back (std::thread (log_lines, 1000));
+      }
+    for (auto &t : threads)
+      {
+        t.join ();
+      }
+    ptrace_shutdown ();
+    log = read_file (path);
+    EXPECT_EQ(8000u, count_lines (log, "| async "));
+    /* Each thread has its ring; lines come out in time order */
+    for (; (end = log.find (" | ", at)) != std::string::npos;
+        at = log.find ('\n', end) + 1)
+      {
+        stamp = log.substr (at, end - at);
+        EXPECT_LE(last, stamp);
+        last = stamp;
+      }
+    remove (path);
+  }
+
+  void
+  log_mixed ()
+  {
+    int x = 0;
+    PTrace(ERROR_LEVEL, "int %d str %s", -42, "hello");
+    PTrace(INFO_LEVEL, "wide %*d|%-*.*s| 100%%", 6, 7, 8, 3, "truncated");
+    PTrace(DEBUG_LEVEL, "long %ld %llu %zu %c", -1L, 1ULL << 40, (size_t) 9,
+           'z');
+    PTrace(ERROR_LEVEL, "float %.3f %g %Le", 3.14159, 1e-5, 2.5L);
+    PTrace(INFO_LEVEL, "ptr %p", (void*) &x);
+    /* Formatted on the caller, kept as text */
+    PTrace(INFO_LEVEL, "text %ls", L"wide");
+  }
+
+  /* The lines without their time stamps */
+  std::string
+  strip_stamps (const std::string &log)
+  {
+    std::string out;
+    size_t at, end;
+    for (at = 0; (end = log.find ('\n', at)) != std::string::npos;
+        at = end + 1)
+      {
+        out += log.substr (log.find (" | ", at), end + 1 - log.find (" | ", at));
+      }
+    return out;
+  }
+
+  std::string
+  decode_file (const char *path)
+  {
+    std::string text;
+    FILE *in = fopen (path, "rb"), *out = tmpfile ();
+    char buf[4096];
+    size_t n;
+
+    if (NULL == in || NULL == out || ptrace_decode (in, out))
+      {
+        text = "decode failed";
+      }
+    else
+      {
+        rewind (out);
+        while ((n = fread (buf, 1, sizeof(buf), out)) > 0)
+          {
+            text.append (buf, n);
+          }
+      }
+    if (in)
+      {
+        fclose (in);
+      }
+    if (out)
+      {
+        fclose (out);
+      }
+    return text;
+  }
+
+  TEST(Binary, DecodesToTheTextLines)
+  {
+    const char *text = "ptrace_text.log", *bin = "ptrace_bin.log";
+    std::string expect;
+
+    remove (text);
+    remove (bin);
+    ASSERT_EQ(0, ptrace_init (text));
+    log_mixed ();
+    ptrace_shutdown ();
+    expect = strip_stamps (read_file (text));
+    EXPECT_NE(std::string::npos, expect.find ("| int -42 str hello\n"));
+    EXPECT_NE(std::string::npos, expect.find ("| text wide\n"));
+
+    ASSERT_EQ(0, ptrace_init_binary (bin));
+    log_mixed ();
+    ptrace_shutdown ();
+    EXPECT_EQ(expect, strip_stamps (decode_file (bin)));
+
+    /* Through the async rings too; sites are described again per file */
+    ASSERT_EQ(0, ptrace_init_binary (bin));
+    ASSERT_EQ(0, ptrace_async_start (64, PTRACE_BLOCK));
+    log_mixed ();
+    log_mixed ();
+    ptrace_shutdown ();
+    EXPECT_EQ(expect + expect, strip_stamps (decode_file (bin)));
+
+    /* Lines dropped from a full ring: the site is still described */
+    ASSERT_EQ(0, ptrace_init_binary (bin));
+    ASSERT_EQ(0, ptrace_async_start (2, PTRACE_DROP_OLDEST));
+    for (int i = 0; i < 10000; i++)
+      {
+        PTrace(ERROR_LEVEL, "dropped %d", 7);
+      }
+    ptrace_shutdown ();
+    expect = decode_file (bin);
+    ASSERT_NE(std::string::npos, expect.find ("| dropped 7\n"));
+    for (size_t at = 0; at < expect.size (); at = expect.find ('\n', at) + 1)
+      {
+        EXPECT_EQ(expect.find ("| dropped 7\n", at),
+                  expect.find ('\n', at) - 11);
+      }
+    remove (text);
+    remove (bin);
+  }
+
+  TEST(Clock, StampsEachSourceToTheMicrosecond)
+  {
+    const char *path = "ptrace_clock.log";
+    const int sources[] =
+      { PTRACE_CLOCK_MONOTONIC, PTRACE_CLOCK_COARSE, PTRACE_CLOCK_TSC };
+    std::string log, stamp, last;
+    struct tm tm;
+    time_t t;
+
+    for (int source : sources)
+      {
+        if (ptrace_clock (source))
+          {
+            EXPECT_EQ(ENOTSUP, errno);
+            continue;
+          }
+        remove (path);
+        ASSERT_EQ(0, ptrace_init (path));
+        t = time (NULL);
+        log_lines (100);
+        ptrace_shutdown ();
+        log = read_file (path);
+        ASSERT_EQ(100u, count_lines (log, "| async "));
+        last.clear ();
+        for (size_t at = 0; at < log.size (); at = log.find ('\n', at) + 1)
+          {
+            /* "YYYY-MM-DD HH:MM:SS.uuuuuu | " */
+            stamp = log.substr (at, log.find (" | ", at) - at);
+            ASSERT_EQ(26u, stamp.size ());
+            EXPECT_EQ('.', stamp[19]);
+            EXPECT_LE(last, stamp);
+            last = stamp;
+          }
+        /* Within a few seconds of the wall clock */
+        memset (&tm, 0, sizeof(tm));
+        strptime (last.c_str (), "%Y-%m-%d %H:%M:%S", &tm);
+        tm.tm_isdst = -1;
+        EXPECT_NEAR((double) t, (double) mktime (&tm), 2);
+      }
+    ptrace_clock (PTRACE_CLOCK_MONOTONIC);
+    remove (path);
+  }
+
+  /* Wait up to a second for the runtime level to become level */
+  bool
+  level_becomes (int level)
+  {
+    for (int i = 0; i < 100 && ptrace_get_level () != level; i++)
+      {
+        std::this_thread::sleep_for (std::chrono::milliseconds (10));
+      }
+    return ptrace_get_level () == level;
+  }
+
+  TEST(Level, RuntimeLevelGatesLines)
+  {
+    const char *path = "ptrace_level.log", *control = "ptrace_level.ctl";
+    std::string log;
+
+    remove (path);
+    ASSERT_EQ(0, ptrace_init (path));
+    ptrace_set_level (ERROR_LEVEL);
+    PTrace(INFO_LEVEL, "skipped");
+    PTrace(ERROR_LEVEL, "kept");
+    ptrace_flush ();
+    log = read_file (path);
+    EXPECT_EQ(std::string::npos, log.find ("| skipped\n"));
+    EXPECT_NE(std::string::npos, log.find ("| kept\n"));
+
+    /* A signal steps it up */
+    ASSERT_EQ(0, ptrace_level_signal (SIGUSR2));
+    raise (SIGUSR2);
+    EXPECT_EQ(INFO_LEVEL, ptrace_get_level ());
+    signal (SIGUSR2, SIG_DFL);
+
+    /* So does the control file, as it changes */
+    std::ofstream (control) << "debug\n";
+    ASSERT_EQ(0, ptrace_level_watch (control, 10));
+    EXPECT_TRUE(level_becomes (DEBUG_LEVEL));
+    std::ofstream (control) << " none ";
+    EXPECT_TRUE(level_becomes (NO_LOG));
+    PTrace(ERROR_LEVEL, "silenced");
+    ptrace_level_watch (NULL, 0);
+
+    ptrace_set_level (DEBUG_LEVEL);
+    ptrace_shutdown ();
+    EXPECT_EQ(std::string::npos, read_file (path).find ("| silenced\n"));
+    remove (path);
+    remove (control);
+  }
+
+  void
+  log_debug_a ()
+  {
+    PTrace(DEBUG_LEVEL, "debug a");
+  }
+
+  void
+  log_debug_b ()
+  {
+    PTrace(DEBUG_LEVEL, "debug b");
+  }
+
+  TEST(Level, RulesSetTheLevelOfSomeSites)
+  {
+    const char *path = "ptrace_rules.log";
+    std::string log, sites;
+    char buf[4096];
+    size_t n;
+    FILE *out;
+
+    remove (path);
+    ASSERT_EQ(0, ptrace_init (path));
+    ptrace_set_level (ERROR_LEVEL);
+    ASSERT_EQ(0, ptrace_control ("file ptrace_test.cpp func log_debug_a "
+                                 "level debug"));
+    log_debug_a ();
+    log_debug_b ();
+    ptrace_flush ();
+    log = read_file (path);
+    EXPECT_EQ(1u, count_lines (log, "| debug a\n"));
+    EXPECT_EQ(0u, count_lines (log, "| debug b\n"));
+
+    /* Patterns, and the last matching rule wins */
+    ASSERT_EQ(0, ptrace_control ("func log_debug_* level debug"));
+    ASSERT_EQ(0, ptrace_control ("file */ptrace_test.cpp func log_debug_b "
+                                 "level none"));
+    log_debug_a ();
+    log_debug_b ();
+    ptrace_flush ();
+    log = read_file (path);
+    EXPECT_EQ(2u, count_lines (log, "| debug a\n"));
+    EXPECT_EQ(0u, count_lines (log, "| debug b\n"));
+
+    out = tmpfile ();
+    ASSERT_TRUE(out != NULL);
+    ptrace_list_sites (out);
+    rewind (out);
+    while ((n = fread (buf, 1, sizeof(buf), out)) > 0)
+      {
+        sites.append (buf, n);
+      }
+    fclose (out);
+    EXPECT_NE(std::string::npos,
+              sites.find ("[log_debug_a] debug on \"debug a\"\n"));
+    EXPECT_NE(std::string::npos,
+              sites.find ("[log_debug_b] debug off \"debug b\"\n"));
+
+    /* Without the rules, back to the runtime level */
+    ASSERT_EQ(0, ptrace_control ("file */ptrace_test.cpp func log_debug_b "
+                                 "level default"));
+    ASSERT_EQ(0, ptrace_control ("func log_debug_* level default"));
+    log_debug_b ();
+    ASSERT_EQ(0, ptrace_control ("file ptrace_test.cpp func log_debug_a "
+                                 "level default"));
+    log_debug_a ();
+    ptrace_shutdown ();
+    log = read_file (path);
+    EXPECT_EQ(2u, count_lines (log, "| debug a\n"));
+    EXPECT_EQ(0u, count_lines (log, "| debug b\n"));
+
+    EXPECT_EQ(-1, ptrace_control ("level debug"));
+    EXPECT_EQ(-1, ptrace_control ("file x.c level loud"));
+    EXPECT_EQ(EINVAL, errno);
+    ptrace_set_level (DEBUG_LEVEL);
+    remove (path);
+  }
+
+  TEST(Site, KnowsItsBasenameAtCompileTime)
+  {
+    static const ptrace_site_t site = PTRACE_SITE_INIT(INFO_LEVEL, "", 0);
+    ASSERT_TRUE(site.base != NULL);
+    EXPECT_STREQ("ptrace_test.cpp", site.base);
+  }
+
+  enum class shade
+  {
+    dark = 7
+  };
+
+  void
+  plog_mixed ()
+  {
+    std::string name ("tar");
+    int x = 0;
+    (void) x;
+    PLog(ERROR_LEVEL, "int {} uint {} neg {} min {}", 42, 7u, -13L,
+         (long long) INT64_MIN);
+    PLog(INFO_LEVEL, "str {} {} char {} bool {} {}", "lit", name, 'c', true,
+         false);
+    PLog(INFO_LEVEL, "double {} {} {} enum {} {{braces}}", 0.1, 0.1 + 0.2, 2.5f,
+         shade::dark);
+    PLog(DEBUG_LEVEL, "no fields");
+  }
+
+  TEST(Cxx, PLogWritesEachTypeInPlace)
+  {
+    const char *path = "ptrace_cxx.log", *bin = "ptrace_cxx.bin";
+    std::string log;
+
+    remove (path);
+    ASSERT_EQ(0, ptrace_init (path));
+    plog_mixed ();
+    ptrace_shutdown ();
+    log = read_file (path);
+    EXPECT_EQ(4u, count_lines (log, " | ptrace_test.cpp | plog_mixed:"));
+    EXPECT_NE(std::string::npos,
+              log.find ("| int 42 uint 7 neg -13 min -9223372036854775808\n"));
+    EXPECT_NE(std::string::npos,
+              log.find ("| str lit tar char c bool true false\n"));
+    EXPECT_NE(std::string::npos,
+              log.find ("| double 0.1 0.30000000000000004 2.5 enum 7 {braces}\n"));
+    EXPECT_NE(std::string::npos, log.find ("| DEBUG   | "));
+    EXPECT_NE(std::string::npos, log.find ("| no fields\n"));
+
+    /* The same text comes out of the async rings and a binary log */
+    log = strip_stamps (log);
+    ASSERT_EQ(0, ptrace_init (path));
+    ASSERT_EQ(0, ptrace_async_start (64, PTRACE_BLOCK));
+    plog_mixed ();
+    ptrace_shutdown ();
+    EXPECT_EQ(log + log, strip_stamps (read_file (path)));
+    ASSERT_EQ(0, ptrace_init_binary (bin));
+    plog_mixed ();
+    ptrace_shutdown ();
+    EXPECT_EQ(log, strip_stamps (decode_file (bin)));
+    remove (path);
+    remove (bin);
+  }
+
+  TEST(Limit, SamplesRateLimitsAndFolds)
+  {
+    const char *path = "ptrace_limit.log";
+    std::string log;
+    unsigned long dropped = 0;
+    size_t at;
+
+    remove (path);
+    ASSERT_EQ(0, ptrace_init (path));
+    for (int i = 0; i < 100; i++)
+      {
+        PTraceEvery(INFO_LEVEL, 10, "every %d", i);
+      }
+    for (int i = 0; i < 1000; i++)
+      {
+        PTraceRate(ERROR_LEVEL, 1, 5, "rate %d", i);
+      }
+    for (int i = 0; i < 300; i++)
+      {
+        PTraceFold(ERROR_LEVEL, "fold %d", i / 100);
+      }
+    ptrace_shutdown ();
+    log = read_file (path);
+
+    EXPECT_EQ(10u, count_lines (log, "| every "));
+    EXPECT_NE(std::string::npos, log.find ("| every 90\n"));
+
+    /* A burst of 5, and the rest counted */
+    EXPECT_LE(5u, count_lines (log, "| rate "));
+    EXPECT_GE(6u, count_lines (log, "| rate "));
+    for (at = 0; (at = log.find (" lines dropped by the rate limit", at))
+        != std::string::npos; at++)
+      {
+        dropped += strtoul (log.c_str () + log.rfind (' ', at - 1) + 1, NULL,
+                            10);
+      }
+    EXPECT_EQ(1000u, dropped + count_lines (log, "| rate "));
+
+    EXPECT_EQ(3u, count_lines (log, "| fold "));
+    EXPECT_EQ(3u, count_lines (log, ": last message repeated 99 times\n"));
+    remove (path);
+  }
+}